@@ -1,8 +1,12 @@
 #include <analysis.hh>
+#include <sparse.hh>
 #include <iostream>
 #include <sstream>
 #include <set>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 Analyser::Analyser()
   : bg()
@@ -10,8 +14,13 @@ Analyser::Analyser()
   , crop()
   , lastclick( -1, -1 )
   , bgframes()
+  , kernels()
   , fps(1)
   , threshold( 0x40 )
+  , stride( 1 )
+  , strideerr( 2 )
+  , tile( 0 )
+  , fgstore()
   , hilite(false)
   , soundsize(false)
 {
@@ -122,51 +131,146 @@ Analyser::finish( Pass0& pass0 )
             row[imgidx] = uint8_t(int(pass0.avg(bgdidx)));
           }
     }
-    
+  
+  select();
 }
   
-void
-Analyser::pass1( cv::Mat const& img )
+/* Pixels: per pixel loops, specialized for a channel count (1, 3 or
+ * 4, the 4th being ignored), iterating over a given region (the
+ * region of interest, or a tile of it).
+ */
+template <unsigned CHANNELS>
+struct Pixels
 {
-  if (img.depth() != CV_8U) throw Ouch();
-  if ((bg.rows != img.rows) or (bg.cols != img.cols) or
-      (bg.channels() != img.channels()) or (bg.step != img.step)) throw Ouch();
-  // for (int idx = 0; idx < 3; ++idx) if (img->colorModel[idx] == "RGB"[3]) throw Ouch();
-  // for (int idx = 0; idx < 3; ++idx) if (img->channelSeq[idx] == "RGB"[3]) throw Ouch();
+  static uint8_t luminance( uint8_t const* ipix, uint8_t const* bpix )
+  {
+    if (CHANNELS == 1)
+      return abs( (int)ipix[0] - (int)bpix[0] );
+    unsigned dev0 = abs( (int)ipix[0] - (int)bpix[0] ), dev1 = abs( (int)ipix[1] - (int)bpix[1] ), dev2 = abs( (int)ipix[2] - (int)bpix[2] );
+    return (0x4c8b43*dev2 + 0x9645a2*dev1 + 0x1d2f1b*dev0 + 0x800000) >> 24;
+  }
+  
+  static void invert( uint8_t* pix ) { for (unsigned c = 0; c < std::min( CHANNELS, 3u ); ++c) pix[c] ^= 0xff; }
+  
+  static void moments( Analyser const& an, cv::Mat const& img, Analyser::ROI const& roi, Moments& m )
+  {
+    unsigned const threshold = an.threshold;
+    for (uintptr_t y = roi.y0; y < roi.y1; ++y)
+      {
+        uint8_t const* ipix = img.ptr<uint8_t>(y) + roi.x0*CHANNELS;
+        uint8_t const* bpix = an.bg.ptr<uint8_t>(y) + roi.x0*CHANNELS;
+        for (uintptr_t x = roi.x0; x < roi.x1; ++x, ipix += CHANNELS, bpix += CHANNELS)
+          {
+            uint8_t l = luminance( ipix, bpix );
+            if (l < threshold) continue;
+            m.add( x, y, l );
+          }
+      }
+  }
+  
+  /* collect: moments, while storing pixels reaching store's floor */
+  static void collect( Analyser const& an, cv::Mat const& img, Analyser::ROI const& roi, Moments& m, SparseWriter& store )
+  {
+    unsigned const threshold = an.threshold, floor = store.floor, lowest = std::min( threshold, floor );
+    for (uintptr_t y = roi.y0; y < roi.y1; ++y)
+      {
+        uint8_t const* ipix = img.ptr<uint8_t>(y) + roi.x0*CHANNELS;
+        uint8_t const* bpix = an.bg.ptr<uint8_t>(y) + roi.x0*CHANNELS;
+        for (uintptr_t x = roi.x0; x < roi.x1; ++x, ipix += CHANNELS, bpix += CHANNELS)
+          {
+            uint8_t l = luminance( ipix, bpix );
+            if (l < lowest) continue;
+            if (l >= floor) store.pixel( x, y, l );
+            if (l >= threshold) m.add( x, y, l );
+          }
+      }
+  }
+};
+
+/* Kernel: pixel loops, with redraw further specialized for the absence
+ * (or presence) of a crop region to invert.
+ */
+template <unsigned CHANNELS, bool CROP>
+struct Kernel : Pixels<CHANNELS>
+{
+  typedef Pixels<CHANNELS> Base;
+  using Base::luminance;
+  using Base::invert;
+  
+  static void redraw( Analyser const& an, cv::Mat& img )
+  {
+    Analyser::ROI roi = CROP ? an.roi() : Analyser::ROI( 0, img.cols, 0, img.rows );
+    uintptr_t const width = img.cols, height = img.rows;
     
-  uintptr_t height = img.rows, width = img.cols, channels = img.channels();
+    if (CROP)
+      {
+        // Inverting colors outside of the region of interest
+        for (uintptr_t y = 0; y < height; ++y)
+          {
+            uint8_t* irow = img.ptr<uint8_t>(y);
+            bool inside = (y >= roi.y0) and (y < roi.y1);
+            uintptr_t xskip = inside ? roi.x0 : width, xresume = inside ? roi.x1 : width;
+            for (uintptr_t x = 0; x < xskip; ++x)
+              invert( &irow[x*CHANNELS] );
+            for (uintptr_t x = xresume; x < width; ++x)
+              invert( &irow[x*CHANNELS] );
+          }
+      }
+    
+    if (not an.hilite)
+      return;
+    
+    unsigned const threshold = an.threshold;
+    for (uintptr_t y = roi.y0; y < roi.y1; ++y)
+      {
+        uint8_t* ipix = img.ptr<uint8_t>(y) + roi.x0*CHANNELS;
+        uint8_t const* bpix = an.bg.ptr<uint8_t>(y) + roi.x0*CHANNELS;
+        for (uintptr_t x = roi.x0; x < roi.x1; ++x, ipix += CHANNELS, bpix += CHANNELS)
+          {
+            if (luminance( ipix, bpix ) < threshold) continue;
+            ipix[0] ^= 0xff;
+            if (CHANNELS >= 3) ipix[2] ^= 0xff;
+          }
+      }
+  }
+  
+  static Analyser::Kernels const table;
+};
 
-  // Computing center and orientation of the deviation from background
-  Point<double> center(0.,0.);
-  double xxv = 0.0, yyv = 0.0, xyv = 0.0, sum = 0.0;
-  for (uintptr_t y = 0, ry = height; y < height; ++y, --ry)
+template <unsigned CHANNELS, bool CROP>
+Analyser::Kernels const Kernel<CHANNELS,CROP>::table = { CHANNELS, &Base::moments, &Base::collect, &Kernel<CHANNELS,CROP>::redraw };
+
+/* select: choose pixel kernels after the background format (and crop)
+ */
+void
+Analyser::select()
+{
+  bool cropped = crop[0] or crop[1] or crop[2] or crop[3];
+  switch (bg.channels())
     {
-      if ((y < crop[2]) or (ry <= crop[3]))
-        continue;
-      uint8_t const* irow = img.ptr<uint8_t>(y);
-      uint8_t* brow = bg.ptr<uint8_t>(y);
-      for (uintptr_t x = 0, rx = width; x < width; ++x, --rx)
-        {
-          if ((x < crop[0]) or (rx <= crop[1]))
-            continue;
-          uintptr_t imgidx = x*channels;
-          uint8_t const* ipix = &irow[imgidx];
-          uint8_t* bpix = &brow[imgidx];
-          // Computing deviation from background
-          uint8_t dev[3] = {0};
-          for (uintptr_t c = 0; c < channels; ++c)
-            dev[c] = abs( (int)ipix[c] - (int)bpix[c] );
-          // Computing luminescence
-          uint8_t l = (0x4c8b43*dev[2] + 0x9645a2*dev[1] + 0x1d2f1b*dev[0] + 0x800000) >> 24;
-          if (l < threshold) continue;
-          center += Point<double>( x, y )*l;
-          sum += l;
-          xxv += x*x*l; yyv += y*y*l; xyv += x*y*l;
-        }
+    case 1: kernels = cropped ? &Kernel<1,true>::table : &Kernel<1,false>::table; break;
+    case 3: kernels = cropped ? &Kernel<3,true>::table : &Kernel<3,false>::table; break;
+    case 4: kernels = cropped ? &Kernel<4,true>::table : &Kernel<4,false>::table; break;
+    default: throw Ouch();
     }
+}
+
+Analyser::ROI
+Analyser::roi() const
+{
+  uintptr_t width = bg.cols, height = bg.rows;
+  ROI r( std::min( crop[0], width ), width - std::min( crop[1], width ), std::min( crop[2], height ), height - std::min( crop[3], height ) );
+  if (r.x1 < r.x0) r.x1 = r.x0;
+  if (r.y1 < r.y0) r.y1 = r.y0;
+  return r;
+}
+
+Mice
+Moments::mice() const
+{
   // Averaging first and second orders sums
-  center.x /= sum; center.y /= sum;
-  xxv /= sum; yyv /= sum; xyv /= sum;
+  Point<double> center( x / sum, y / sum );
+  double xxv = xx / sum, yyv = yy / sum, xyv = xy / sum;
   xxv -= center.x*center.x; yyv -= center.y*center.y; xyv -= center.x*center.y;
 
   // Computing final deviation blob (mice ?) params.
@@ -176,43 +280,222 @@ Analyser::pass1( cv::Mat const& img )
   { double norm = 1/sqrt( direction.sqnorm() ); direction *= norm; }
   // Major is the extension in the direction of mice and minor is perpendicular
   double mjr = sqrt( (xxv+yyv)/2 + t0 ), mnr = sqrt( (xxv+yyv)/2 - t0 );
-  mices.push_back( Mice( center, direction, mjr, mnr ) );
+  return Mice( center, direction, mjr, mnr );
 }
-  
+
 void
-Analyser::redraw( FrameIterator& _fi )
+Analyser::check( cv::Mat const& img ) const
 {
-  cv::Mat& img = _fi.frame;
   if (img.depth() != CV_8U) throw Ouch();
   if ((bg.rows != img.rows) or (bg.cols != img.cols) or
       (bg.channels() != img.channels()) or (bg.step != img.step)) throw Ouch();
-  // for (int idx = 0; idx < 3; ++idx) if (img->colorModel[idx] == "RGB"[3]) throw Ouch();
-  // for (int idx = 0; idx < 3; ++idx) if (img->channelSeq[idx] == "RGB"[3]) throw Ouch();
-    
-  uintptr_t height = img.rows, width = img.cols, channels = img.channels();
-    
-  for (uintptr_t y = 0, ry = height; y < height; ++y, --ry) {
-    bool docrop = (y < crop[2]) or (ry <= crop[3]);
-    uint8_t* irow = img.ptr<uint8_t>(y);
-    uint8_t* brow = bg.ptr<uint8_t>(y);
-    for (uintptr_t x = 0, rx = width; x < width; ++x, --rx) {
-      uintptr_t imgidx = x*channels;
-      uint8_t* ipix = &irow[imgidx];
-      if (docrop or (x < crop[0]) or (rx <= crop[1]))
-        { ipix[0] ^= 0xff; ipix[1] ^= 0xff; ipix[2] ^= 0xff; continue; }
-      uint8_t* bpix = &brow[imgidx];
-      uint8_t dev[3] = {0};
-      for (uintptr_t c = 0; c < channels; ++c)
-        dev[c] = abs( (int)ipix[c] - (int)bpix[c] );
-      uint8_t l = (0x4c8b43*dev[2] + 0x9645a2*dev[1] + 0x1d2f1b*dev[0] + 0x800000) >> 24;
-      if (hilite and (l >= threshold))
-        { ipix[0] ^= 0xff; ipix[1] ^= 0x00; ipix[2] ^= 0xff; continue; }
-      // if () { /* ipix[0] = 0x00;   ipix[1] = 0x00;   ipix[2] = 0x00; */ continue; }
-      // else               { /* ipix[0] = dev[0]; ipix[1] = dev[1]; ipix[2] = dev[2]; */ }
-      //ipix[0] = 0xff; ipix[1] = 0xff; ipix[2] = 0xff;
+  if (not kernels or (kernels->channels != unsigned(img.channels()))) throw Ouch();
+}
+
+/* changed: whether some component of the tile deviates from background
+ * by at least `threshold`. Since luminance never exceeds the largest
+ * component deviation, unchanged tiles hold no pixel above threshold.
+ */
+static bool
+changed( cv::Mat const& img, cv::Mat const& bg, Analyser::ROI const& tile, unsigned threshold )
+{
+  if (threshold == 0) return true;
+  if (threshold > 0xff) return false;
+  
+  uintptr_t const channels = img.channels(), x0 = tile.x0*channels, x1 = tile.x1*channels;
+  for (uintptr_t y = tile.y0; y < tile.y1; ++y)
+    {
+      uint8_t const* irow = img.ptr<uint8_t>(y);
+      uint8_t const* brow = bg.ptr<uint8_t>(y);
+      uintptr_t x = x0;
+#ifdef __SSE2__
+      __m128i devmax = _mm_setzero_si128();
+      for (; x + 16 <= x1; x += 16)
+        {
+          __m128i a = _mm_loadu_si128( (__m128i const*)&irow[x] ), b = _mm_loadu_si128( (__m128i const*)&brow[x] );
+          devmax = _mm_max_epu8( devmax, _mm_or_si128( _mm_subs_epu8( a, b ), _mm_subs_epu8( b, a ) ) );
+        }
+      // Some byte >= threshold iff saturated subtraction of threshold-1 leaves it non zero
+      __m128i over = _mm_subs_epu8( devmax, _mm_set1_epi8( char(threshold - 1) ) );
+      if (_mm_movemask_epi8( _mm_cmpeq_epi8( over, _mm_setzero_si128() ) ) != 0xffff)
+        return true;
+#endif
+      for (; x < x1; ++x)
+        if (unsigned( abs( (int)irow[x] - (int)brow[x] ) ) >= threshold)
+          return true;
     }
-  }
-  Mice const& mice = mices[_fi.idx];
+  return false;
+}
+
+/* measure: computes the deviation blob of a frame; in tiled mode, only
+ * considers changed tiles, reporting the skipped fraction in `skipped`.
+ * Pixels reaching floor of `fg` (if any) are stored along the way.
+ */
+Mice
+Analyser::measure( cv::Mat const& img, double* skipped, SparseWriter* fg ) const
+{
+  check( img );
+  // Computing center and orientation of the deviation from background
+  Moments moments;
+  ROI const whole = roi();
+  if (fg) fg->begin();
+  if (tile == 0)
+    {
+      if (fg) kernels->collect( *this, img, whole, moments, *fg );
+      else    kernels->moments( *this, img, whole, moments );
+    }
+  else
+    {
+      // Moments being sums of integers, tile order leaves them exact
+      uintptr_t tiles = 0, skips = 0;
+      for (uintptr_t y = whole.y0; y < whole.y1; y += tile)
+        for (uintptr_t x = whole.x0; x < whole.x1; x += tile)
+          {
+            ROI part( x, std::min<uintptr_t>( x + tile, whole.x1 ), y, std::min<uintptr_t>( y + tile, whole.y1 ) );
+            tiles += 1;
+            if (not changed( img, bg, part, fg ? std::min( threshold, fg->floor ) : threshold ))
+              skips += 1;
+            else if (fg)
+              kernels->collect( *this, img, part, moments, *fg );
+            else
+              kernels->moments( *this, img, part, moments );
+          }
+      if (skipped) *skipped = tiles ? double(skips) / tiles : 1;
+    }
+  if (fg) fg->end();
+  return moments.mice();
+}
+
+void
+Analyser::pass1( cv::Mat const& img )
+{
+  double skipped = 0;
+  mices.push_back( measure( img, &skipped, fgstore ) );
+  if (tile)
+    tileskips.push_back( skipped );
+}
+
+/* quiet: whether the mice stayed put between two sampled frames, so
+ * that frames in between may be interpolated rather than analysed.
+ */
+bool
+Analyser::quiet( Mice const& head, Mice const& tail ) const
+{
+  if (head.hasnan() or tail.hasnan()) return false;
+  if ((head.elongation() <= minelongation) or (tail.elongation() <= minelongation)) return false;
+  return
+    ((tail.p - head.p).sqnorm() <= strideerr*strideerr) and
+    (fabs( tail.mjr - head.mjr ) <= strideerr) and
+    (fabs( tail.mnr - head.mnr ) <= strideerr);
+}
+
+/* stridepass1: first analyses one frame out of `stride`, then densely
+ * analyses (seeking back) intervals between samples that are not
+ * quiet. Frames of quiet intervals are left invalid and marked strided,
+ * for trajectory() to interpolate. Note that the error bound only
+ * holds for motions that do not revert within a stride. Progress goes
+ * to `log` (see FrameIterator::progress).
+ * returns: number of frames actually analysed
+ */
+uintptr_t
+Analyser::stridepass1( FrameIterator& fi, std::ostream& log, bool tty )
+{
+  Mice unknown( Point<double>( nan(""), nan("") ), Point<double>( nan(""), nan("") ), nan(""), nan("") );
+  unknown.strided = true;
+  
+  std::vector<uintptr_t> samples;
+  for (uintptr_t pos = 0;; ++pos)
+    {
+      bool sample = (pos % stride) == 0;
+      if (not (sample ? fi.next() : fi.skip()))
+        break;
+      fi.progress( log, tty );
+      if (sample)
+        {
+          samples.push_back( pos );
+          mices.push_back( measure( fi.frame ) );
+        }
+      else
+        mices.push_back( unknown );
+    }
+  
+  uintptr_t const count = mices.size();
+  samples.push_back( count ); // closing trailing interval
+  
+  Spans spans;
+  for (uintptr_t sidx = 1; sidx < samples.size(); ++sidx)
+    {
+      uintptr_t head = samples[sidx-1], tail = samples[sidx];
+      if ((tail - head) < 2) continue;
+      if ((tail < count) and quiet( mices[head], mices[tail] )) continue;
+      spans.push_back( Spans::value_type( head+1, tail ) );
+    }
+  log << "\n#refining: " << spans.size() << '/' << (samples.size() - 1) << " intervals" << std::endl;
+  
+  return (samples.size() - 1) + remeasure( fi, spans, count, stride );
+}
+
+/* remeasure: analyses again the frames of given (ordered) spans,
+ * reading forward over gaps shorter than `reach` and seeking over
+ * longer ones; `at` is the frame the iterator would yield next.
+ * returns: number of frames analysed
+ */
+uintptr_t
+Analyser::remeasure( FrameIterator& fi, Spans const& spans, uintptr_t at, uintptr_t reach )
+{
+  uintptr_t analysed = 0;
+  for (Spans::value_type const& span : spans)
+    {
+      if ((at > span.first) or ((span.first - at) > reach))
+        {
+          if (not fi.seek( span.first )) throw Ouch();
+          at = span.first;
+        }
+      for (; at < span.first; ++at)
+        if (not fi.skip()) throw Ouch();
+      for (; at < span.second; ++at)
+        {
+          if (not fi.next()) throw Ouch();
+          mices[at] = measure( fi.frame );
+          analysed += 1;
+        }
+    }
+  
+  return analysed;
+}
+
+/* reanalyse: analyses again rejected frames only (typically of loaded
+ * results, with new parameters), for trajectory() to run again; frames
+ * interpolated by stride mode are left as such.
+ * returns: number of frames analysed
+ */
+uintptr_t
+Analyser::reanalyse( FrameIterator& fi, uintptr_t reach )
+{
+  Spans spans;
+  for (uintptr_t idx = 0, end = mices.size(); idx < end; ++idx)
+    {
+      if (not mices[idx].rejected()) continue;
+      if (spans.size() and spans.back().second == idx)
+        spans.back().second += 1;
+      else
+        spans.push_back( Spans::value_type( idx, idx+1 ) );
+    }
+  
+  return remeasure( fi, spans, 0, reach );
+}
+  
+void
+Analyser::redraw( FrameIterator& _fi )
+{
+  cv::Mat& img = _fi.frame;
+  check( img );
+  kernels->redraw( *this, img );
+  
+  uintptr_t height = img.rows, width = img.cols, channels = img.channels();
+  // idx counts frames delivered so far, the current one included
+  if ((_fi.idx == 0) or (_fi.idx > mices.size())) throw Ouch();
+  Mice const& mice = mices[_fi.idx - 1];
     
   uint8_t red = 0, blue = 0;
   if (mice.valid)  red = 0xff;
@@ -229,7 +512,8 @@ Analyser::redraw( FrameIterator& _fi )
       uint8_t green = mjp > 0 ? 0xff : 0;
       if ((mjp*mjp + mnp*mnp) < 1) {
         uint8_t* pix = &irow[x*channels];
-        pix[0] = blue; pix[1] = green; pix[2] = red;
+        if (channels >= 3) { pix[0] = blue; pix[1] = green; pix[2] = red; }
+        else               { pix[0] = (red ? 0x80 : 0x00) | (green ? 0x7f : 0x00); }
       }
     }
   }
@@ -377,6 +661,39 @@ Analyser::dumpresults( std::ostream& sink )
 	   << ',' << itr->ep1().x << ',' << -itr->ep1().y
            << ',' << int(itr->valid)
            << ',' << itr->mjr << ',' << itr->mnr
+           << ',' << int(itr->strided)
 	   << '\n';
     }
 }
+
+/* loadresults: reloads per frame results as written by dumpresults
+ */
+void
+Analyser::loadresults( std::istream& source )
+{
+  std::string line;
+  // Skipping command line, settings and header
+  for (int idx = 0; idx < 3; ++idx)
+    if (not std::getline( source, line )) throw Ouch();
+  
+  mices.clear();
+  while (std::getline( source, line ))
+    {
+      // elongation,Xmid,Ymid,Xhead,Yhead,Xtail,Ytail,valid,mjr,mnr[,strided]
+      double fields[11] = {};
+      char const* cp = line.c_str();
+      for (int idx = 0; idx < 11; ++idx)
+        {
+          char* end;
+          fields[idx] = strtod( cp, &end );
+          if (end == cp) { if (idx < 10) throw Ouch(); break; }
+          cp = end + (*end == ',');
+        }
+      Point<double> p( fields[1], -fields[2] ), ep0( fields[3], -fields[4] );
+      double mjr = fields[8], mnr = fields[9];
+      Mice mice( p, (ep0 - p) / mjr, mjr, mnr );
+      mice.valid = fields[7] and not mice.hasnan();
+      mice.strided = fields[10] and not mice.valid;
+      mices.push_back( mice );
+    }
+}
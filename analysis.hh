@@ -3,18 +3,47 @@
 
 #include <opencv2/core/mat.hpp>
 #include <geometry.hh>
+#include <framepool.hh>
+#include <memory>
 #include <vector>
+#include <utility>
+#include <istream>
+#include <ostream>
 #include <inttypes.h>
 
 struct FrameIterator
 {
-  FrameIterator() : frame(), idx() {}
+  FrameIterator() : frame(), idx(), fps(1), buffer(), pool() {}
   virtual ~FrameIterator() {}
   
   virtual bool next() = 0;
+  /* skip: advance one frame, without necessarily decoding it */
+  virtual bool skip() { return next(); }
+  /* seek: position iterator so that next() yields frame `pos` */
+  virtual bool seek( uintptr_t pos ) { return false; }
+
+  double sec() const { return double(idx) / fps; }
+  /* msec: presentation time of current frame */
+  virtual double msec() const { return double(idx - 1) * 1000 / fps; }
+
+  void progress( std::ostream& term, bool tty = true ) const
+  {
+    // Terminals get a ticker each second, logs a line each minute
+    uintptr_t ufps = std::max<uintptr_t>( fps, 1 );
+    if (idx % (tty ? ufps : 60*ufps))
+      return;
+    if (tty) term << "\e[G\e[KDone: " << (idx / ufps) << "s ";
+    else     term << "Done: " << (idx / ufps) << "s\n";
+    term.flush();
+  }
 
   cv::Mat frame;
   uintptr_t idx;
+  double fps;
+  /* Pooled iterators decode into recycled buffers; holding `buffer`
+   * keeps the current frame alive past next(). */
+  FramePool::Handle buffer;
+  std::shared_ptr<FramePool> pool;
 };
   
 struct Mice
@@ -24,9 +53,10 @@ struct Mice
   Point<double> s;
   double mjr, mnr;
   bool valid;
+  bool strided; /* not analysed: within a quiet stride interval (see stridepass1) */
   
   Mice( Point<double> _p, Point<double> _d, double _mjr, double _mnr )
-    : p(_p), d(_d), mjr(_mjr), mnr(_mnr), valid(not hasnan())
+    : p(_p), d(_d), mjr(_mjr), mnr(_mnr), valid(not hasnan()), strided(false)
   {}
   
   double length() const { return sqrt( (ep1() - ep0()).sqnorm() ); }
@@ -40,6 +70,26 @@ struct Mice
   Point<double> mn() const { return (!d) / mnr; }
   
   double elongation() const { return mjr / mnr; }
+  /* rejected: analysed, but found invalid */
+  bool rejected() const { return not valid and not strided; }
+};
+
+struct SparseWriter;
+
+/* Moments: deviation luminance weighted pixel moments */
+struct Moments
+{
+  Moments() : x(), y(), xx(), yy(), xy(), sum() {}
+  
+  void add( uintptr_t _x, uintptr_t _y, unsigned l )
+  {
+    x += double(_x)*l; y += double(_y)*l; sum += l;
+    xx += _x*_x*l; yy += _y*_y*l; xy += _x*_y*l;
+  }
+  
+  Mice mice() const;
+  
+  double x, y, xx, yy, xy, sum;
 };
 
 struct Analyser
@@ -60,6 +110,22 @@ struct Analyser
     uintptr_t           records;
   };
 
+  /* ROI: region of interest, i.e. frame minus crop margins */
+  struct ROI
+  {
+    ROI( uintptr_t _x0, uintptr_t _x1, uintptr_t _y0, uintptr_t _y1 ) : x0(_x0), x1(_x1), y0(_y0), y1(_y1) {}
+    uintptr_t x0, x1, y0, y1;
+  };
+
+  /* Kernels: pixel loops selected once per video (see select) */
+  struct Kernels
+  {
+    unsigned channels;
+    void (*moments)( Analyser const&, cv::Mat const&, ROI const&, Moments& );
+    void (*collect)( Analyser const&, cv::Mat const&, ROI const&, Moments&, SparseWriter& );
+    void (*redraw)( Analyser const&, cv::Mat& );
+  };
+  
   cv::Mat             bg;
   std::vector<Mice>   mices;
   double              minelongation;
@@ -69,12 +135,19 @@ struct Analyser
   Point<int>          lastclick;
   std::string         croparg;
   BGSel*              bgframes;
-  unsigned            fps;
+  Kernels const*      kernels;
+  double              fps;
   unsigned            threshold;
+  unsigned            stride;
+  double              strideerr;
+  uintptr_t           tile;
+  std::vector<float>  tileskips;
+  SparseWriter*       fgstore;
   bool                hilite;
   bool                soundsize;
   
   Analyser();
+  ~Analyser() { delete bgframes; }
   
   void click( int x1, int y1 );
   
@@ -88,15 +161,25 @@ struct Analyser
   
   uintptr_t height() const { return bg.empty() ? 0 : bg.rows; }
   uintptr_t width() const { return bg.empty() ? 0 : bg.cols; }
+  ROI roi() const;
   
+  void select();
+  void check( cv::Mat const& img ) const;  
   
+  Mice measure( cv::Mat const& img, double* skipped = 0, SparseWriter* fg = 0 ) const;
   void pass1( cv::Mat const& img );
+  typedef std::vector< std::pair<uintptr_t,uintptr_t> > Spans;
+  uintptr_t stridepass1( FrameIterator& fi, std::ostream& log, bool tty );
+  uintptr_t remeasure( FrameIterator& fi, Spans const& spans, uintptr_t at, uintptr_t reach );
+  uintptr_t reanalyse( FrameIterator& fi, uintptr_t reach );
+  bool quiet( Mice const& head, Mice const& tail ) const;
   
   void redraw( FrameIterator& _fi );
   
   void trajectory();
   
   void dumpresults( std::ostream& sink );
+  void loadresults( std::istream& source );
 };
 
 #endif /* __ANALYSIS_HH__ */
@@ -0,0 +1,119 @@
+#include <framepool.hh>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+struct FramePool::Buffer
+{
+  Buffer( uintptr_t size )
+    : storage(0), mat(), refs(0), owner()
+  {
+#ifdef _WIN32
+    storage = (uint8_t*)_aligned_malloc( size, 4096 );
+#else
+    void* ptr = 0;
+    if (posix_memalign( &ptr, sysconf( _SC_PAGESIZE ), size ) == 0) storage = (uint8_t*)ptr;
+#endif
+    if (not storage) throw std::bad_alloc();
+  }
+  ~Buffer()
+  {
+#ifdef _WIN32
+    _aligned_free( storage );
+#else
+    ::free( storage );
+#endif
+  }
+  
+  uint8_t*                   storage;
+  cv::Mat                    mat;
+  std::atomic<unsigned>      refs;
+  std::shared_ptr<FramePool> owner; /* keeps pool alive while buffer is out */
+};
+
+cv::Mat&
+FramePool::Handle::mat() const
+{
+  return buffer->mat;
+}
+
+void
+FramePool::Handle::retain()
+{
+  if (buffer) buffer->refs += 1;
+}
+
+void
+FramePool::Handle::release()
+{
+  if (buffer and --buffer->refs == 0)
+    {
+      std::shared_ptr<FramePool> owner;
+      owner.swap( buffer->owner );
+      owner->recycle( buffer );
+    }
+  buffer = 0;
+}
+
+std::shared_ptr<FramePool>
+FramePool::create( uintptr_t capacity, int rows, int cols, int type )
+{
+  return std::shared_ptr<FramePool>( new FramePool( capacity, rows, cols, type ) );
+}
+
+FramePool::FramePool( uintptr_t _capacity, int _rows, int _cols, int _type )
+  : allocations(0)
+  , capacity( std::max<uintptr_t>( _capacity, 1 ) )
+  , rows(_rows), cols(_cols), type(_type)
+  , step( uintptr_t(_cols) * CV_ELEM_SIZE(_type) )
+{}
+
+FramePool::~FramePool()
+{
+  for (Buffer* buffer : buffers)
+    delete buffer;
+}
+
+FramePool::Handle
+FramePool::acquire()
+{
+  std::unique_lock<std::mutex> lock( mutex );
+  if (free.empty() and buffers.size() < capacity)
+    {
+      buffers.push_back( new Buffer( step * rows ) );
+      free.push_back( buffers.back() );
+      allocations += 1;
+    }
+  freed.wait( lock, [this] { return not free.empty(); } );
+  Buffer* buffer = free.back();
+  free.pop_back();
+  
+  buffer->refs = 1;
+  buffer->owner = shared_from_this();
+  buffer->mat = cv::Mat( rows, cols, type, buffer->storage, step );
+  return Handle( buffer );
+}
+
+void
+FramePool::adopt( Handle const& handle, cv::Mat const& frame )
+{
+  if (frame.empty() or frame.data == handle.buffer->storage)
+    return;
+  allocations += 1;
+  handle.buffer->mat = frame;
+}
+
+void
+FramePool::recycle( Buffer* buffer )
+{
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    buffer->mat = cv::Mat();
+    free.push_back( buffer );
+  }
+  freed.notify_one();
+}
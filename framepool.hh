@@ -0,0 +1,70 @@
+#ifndef __FRAMEPOOL_HH__
+#define __FRAMEPOOL_HH__
+
+#include <opencv2/core/mat.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <inttypes.h>
+
+/* FramePool: fixed-capacity pool of recycled frame buffers
+ *
+ * Buffers are page aligned, allocated on first need (up to capacity),
+ * and handed out through reference-counted handles; a buffer returns
+ * to the pool when its last handle goes away (which may outlive the
+ * pool's owner). `allocations` counts every frame sized heap
+ * allocation: buffer creations, plus decodes that did not land in
+ * their buffer (see adopt). In steady state, it stays put.
+ */
+struct FramePool : public std::enable_shared_from_this<FramePool>
+{
+  struct Buffer;
+  
+  struct Handle
+  {
+    Handle() : buffer(0) {}
+    Handle( Handle const& h ) : buffer(h.buffer) { retain(); }
+    Handle& operator=( Handle const& h ) { Handle(h).swap(*this); return *this; }
+    ~Handle() { release(); }
+    
+    explicit operator bool() const { return buffer; }
+    cv::Mat& mat() const;
+    void swap( Handle& h ) { std::swap( buffer, h.buffer ); }
+    
+  private:
+    friend struct FramePool;
+    explicit Handle( Buffer* _buffer ) : buffer(_buffer) {}
+    void retain();
+    void release();
+    Buffer* buffer;
+  };
+
+  static std::shared_ptr<FramePool> create( uintptr_t capacity, int rows, int cols, int type );
+  ~FramePool();
+  
+  /* acquire: a free buffer, shaped as a (rows,cols,type) frame; blocks
+   * while all buffers are in use */
+  Handle acquire();
+  
+  /* adopt: checks that `frame`, decoded into the buffer of `handle`,
+   * still uses its storage; otherwise counts the stray allocation and
+   * rebinds the buffer to `frame` until next acquisition. */
+  void adopt( Handle const& handle, cv::Mat const& frame );
+  
+  std::atomic<uintptr_t> allocations;
+  
+private:
+  FramePool( uintptr_t _capacity, int _rows, int _cols, int _type );
+  void recycle( Buffer* buffer );
+  
+  uintptr_t               capacity;
+  int                     rows, cols, type;
+  uintptr_t               step;
+  std::vector<Buffer*>    buffers, free;
+  std::mutex              mutex;
+  std::condition_variable freed;
+};
+
+#endif /* __FRAMEPOOL_HH__ */
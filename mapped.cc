@@ -0,0 +1,189 @@
+#include <mapped.hh>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile( std::string const& path )
+  : base(0)
+  , size(0)
+{
+  HANDLE fh = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0 );
+  if (fh == INVALID_HANDLE_VALUE) throw "Error when opening mapped file";
+  LARGE_INTEGER st;
+  if (not GetFileSizeEx( fh, &st ) or st.QuadPart == 0) { CloseHandle( fh ); throw "Error when reading mapped file"; }
+  size = st.QuadPart;
+  // The view keeps the mapping (and file) alive once handles are closed
+  HANDLE mh = CreateFileMappingA( fh, 0, PAGE_READONLY, 0, 0, 0 );
+  CloseHandle( fh );
+  if (not mh) throw "Error when mapping file";
+  base = (uint8_t*)MapViewOfFile( mh, FILE_MAP_READ, 0, 0, 0 );
+  CloseHandle( mh );
+  if (not base) throw "Error when mapping file";
+}
+
+MappedFile::~MappedFile()
+{
+  UnmapViewOfFile( base );
+}
+
+void
+MappedFile::willneed( uintptr_t offset, uintptr_t length ) const
+{
+  // No portable readahead hint; the sequential scan flag covers playback
+}
+
+#else
+
+MappedFile::MappedFile( std::string const& path )
+  : base(0)
+  , size(0)
+{
+  int fd = open( path.c_str(), O_RDONLY );
+  if (fd < 0) throw "Error when opening mapped file";
+  struct stat st;
+  if (fstat( fd, &st ) != 0 or st.st_size == 0) { close( fd ); throw "Error when reading mapped file"; }
+  size = st.st_size;
+  void* addr = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if (addr == MAP_FAILED) throw "Error when mapping file";
+  base = (uint8_t*)addr;
+  madvise( base, size, MADV_SEQUENTIAL );
+}
+
+MappedFile::~MappedFile()
+{
+  munmap( base, size );
+}
+
+void
+MappedFile::willneed( uintptr_t offset, uintptr_t length ) const
+{
+  if (offset >= size) return;
+  length = std::min( length, size - offset );
+  // madvise requires page aligned addresses
+  uintptr_t page = sysconf( _SC_PAGESIZE ), start = offset / page * page;
+  madvise( base + start, length + (offset - start), MADV_WILLNEED );
+}
+
+#endif
+
+MappedFrameIterator::MappedFrameIterator( std::string const& path, uintptr_t _stop )
+  : FrameIterator()
+  , file( path )
+  , offset(), pitch(), header(), frames(), rows(), cols(), type( CV_8UC1 ), step()
+{
+  char const* hdr = (char const*)file.base;
+  char const* end = (char const*)memchr( hdr, '\n', file.size );
+  if (not end or strncmp( hdr, "YUV4MPEG2 ", 10 ) != 0) throw "Error when reading y4m header";
+  
+  std::string colorspace( "420jpeg" );
+  for (char const* tok = hdr + 10; tok < end;)
+    {
+      char* nxt = const_cast<char*>( tok + 1 );
+      switch (*tok)
+        {
+        case 'W': cols = strtol( tok + 1, &nxt, 10 ); break;
+        case 'H': rows = strtol( tok + 1, &nxt, 10 ); break;
+        case 'F':
+          {
+            double num = strtod( tok + 1, &nxt ), den = 1;
+            if (*nxt == ':') den = strtod( nxt + 1, &nxt );
+            if (den > 0) fps = num / den;
+          }
+          break;
+        case 'C':
+          colorspace.assign( tok + 1, std::find( tok + 1, end, ' ' ) );
+          break;
+        }
+      tok = std::find( (char const*)nxt, end, ' ' );
+      if (tok < end) ++tok;
+    }
+  if (rows <= 0 or cols <= 0) throw "Error when reading y4m header";
+  
+  uintptr_t luma = uintptr_t(rows) * cols, chroma = 0;
+  // 8-bit layouts only (high bit depth tags, e.g. 420p10, use 2-byte samples)
+  if      (colorspace == "420" or colorspace == "420jpeg" or colorspace == "420paldv" or colorspace == "420mpeg2")
+    chroma = 2 * uintptr_t((rows+1)/2) * ((cols+1)/2);
+  else if (colorspace == "422")                chroma = 2 * uintptr_t(rows) * ((cols+1)/2);
+  else if (colorspace == "444")                chroma = 2 * luma;
+  else if (colorspace == "444alpha")           chroma = 3 * luma;
+  else if (colorspace != "mono")               throw "Unsupported y4m colorspace";
+  
+  // Frame headers are assumed identical to the first one (fixed pitch)
+  char const* frm = end + 1;
+  char const* body = (char const*)memchr( frm, '\n', file.size - (frm - hdr) );
+  if (not body or strncmp( frm, "FRAME", 5 ) != 0) throw "Error when reading y4m frame header";
+  body += 1;
+  
+  offset = body - hdr;
+  header = body - frm;
+  pitch = header + luma + chroma;
+  step = cols;
+  setup( _stop );
+}
+
+MappedFrameIterator::MappedFrameIterator( std::string const& path, uintptr_t _stop, int width, int height, int channels, double _fps )
+  : FrameIterator()
+  , file( path )
+  , offset(0), pitch(), header(0), frames(), rows(height), cols(width), type( CV_8UC(channels) ), step( uintptr_t(width)*channels )
+{
+  if (rows <= 0 or cols <= 0 or not (channels == 1 or channels == 3 or channels == 4)) throw "Bad raw frame format";
+  fps = _fps;
+  pitch = step * rows;
+  setup( _stop );
+}
+
+void
+MappedFrameIterator::setup( uintptr_t _stop )
+{
+  frames = std::min<uintptr_t>( (file.size - offset + header) / pitch, _stop );
+  file.willneed( offset, readahead * pitch );
+}
+
+cv::Mat
+MappedFrameIterator::at( uintptr_t pos ) const
+{
+  if (pos >= frames) return cv::Mat();
+  uint8_t* data = file.base + offset + pos * pitch;
+  if (header and memcmp( data - header, "FRAME", 5 ) != 0)
+    throw "Error when reading y4m frame header";
+  return cv::Mat( rows, cols, type, data, step );
+}
+
+bool
+MappedFrameIterator::next()
+{
+  if (idx >= frames) { frame = cv::Mat(); return false; }
+  frame = at( idx );
+  file.willneed( offset + (idx + readahead) * pitch, pitch );
+  idx += 1;
+  return true;
+}
+
+bool
+MappedFrameIterator::skip()
+{
+  if (idx >= frames) return false;
+  idx += 1;
+  return true;
+}
+
+bool
+MappedFrameIterator::seek( uintptr_t pos )
+{
+  if (pos >= frames) return false;
+  idx = pos;
+  file.willneed( offset + pos * pitch, readahead * pitch );
+  return true;
+}
@@ -0,0 +1,63 @@
+#ifndef __MAPPED_HH__
+#define __MAPPED_HH__
+
+#include <analysis.hh>
+#include <string>
+#include <inttypes.h>
+
+/* MappedFile: read-only memory mapping of a whole file */
+struct MappedFile
+{
+  MappedFile( std::string const& path );
+  ~MappedFile();
+
+  /* advise: readahead hint for [offset, offset+length) */
+  void willneed( uintptr_t offset, uintptr_t length ) const;
+
+  uint8_t*  base;
+  uintptr_t size;
+  
+private:
+  MappedFile( MappedFile const& );
+  MappedFile& operator=( MappedFile const& );
+};
+
+/* MappedFrameIterator: zero-copy iteration over uncompressed videos
+ *
+ * Frames are cv::Mat headers pointing straight into the (read-only)
+ * file mapping, with no pool `buffer`: consumers that draw on frames
+ * (e.g. Analyser::redraw) must work on a copy. Frames sit at fixed
+ * offsets so that at() provides random access. Two layouts are
+ * supported:
+ *   - YUV4MPEG2 (.y4m): the luma plane is exposed as a 1-channel frame,
+ *   - raw: packed 8-bit frames of given dimensions and channels.
+ */
+struct MappedFrameIterator : public FrameIterator
+{
+  /* Y4M constructor (dimensions and fps from stream header) */
+  MappedFrameIterator( std::string const& path, uintptr_t _stop );
+  /* raw constructor */
+  MappedFrameIterator( std::string const& path, uintptr_t _stop, int width, int height, int channels, double _fps );
+
+  uintptr_t count() const { return frames; }
+  cv::Mat at( uintptr_t pos ) const;
+
+  virtual bool next() override;
+  virtual bool skip() override;
+  virtual bool seek( uintptr_t pos ) override;
+
+  enum { readahead = 8 };
+  
+private:
+  void setup( uintptr_t _stop );
+  
+  MappedFile  file;
+  uintptr_t   offset;   /* first frame (payload) offset */
+  uintptr_t   pitch;    /* distance between frames */
+  uintptr_t   header;   /* per frame header length */
+  uintptr_t   frames;
+  int         rows, cols, type;
+  uintptr_t   step;
+};
+
+#endif /* __MAPPED_HH__ */
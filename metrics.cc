@@ -0,0 +1,150 @@
+#include <metrics.hh>
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <sstream>
+
+bool
+Zone::contains( Point<double> const& p ) const
+{
+  // Even-odd rule
+  bool inside = false;
+  for (uintptr_t idx = 0, end = polygon.size(), prev = end - 1; idx < end; prev = idx++)
+    {
+      Point<double> const& a = polygon[idx];
+      Point<double> const& b = polygon[prev];
+      if (((a.y > p.y) != (b.y > p.y)) and (p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x))
+        inside = not inside;
+    }
+  return inside;
+}
+
+Metrics::Metrics()
+  : zones()
+  , immobilespeed( 20 )
+  , immobileduration( 1 )
+  , frames(), duration(), validity(), strided(), distance()
+  , speedmean(), speedmax(), speedquantiles()
+  , immobilebouts(), immobiletime()
+  , turning()
+  , occupancy()
+{}
+
+void
+Metrics::loadzones( std::istream& source )
+{
+  for (std::string line; std::getline( source, line );)
+    {
+      line = line.substr( 0, line.find('#') );
+      std::istringstream fields( line );
+      std::string name;
+      if (not (fields >> name)) continue;
+      Zone zone( name );
+      for (std::string vertex; fields >> vertex;)
+        {
+          char const* arg = vertex.c_str();
+          char* end;
+          double x = strtod( arg, &end );
+          if (*end++ != ',') throw Ouch();
+          double y = strtod( end, &end );
+          if (*end != '\0') throw Ouch();
+          zone.polygon.push_back( Point<double>( x, y ) );
+        }
+      if (zone.polygon.size() < 3) throw Ouch();
+      zones.push_back( zone );
+    }
+}
+
+void
+Metrics::compute( std::vector<Mice> const& mices, double fps )
+{
+  frames = mices.size();
+  duration = frames / fps;
+  occupancy.assign( zones.size(), Occupancy() );
+  if (frames == 0) return;
+  
+  std::vector<double> speeds( frames );
+  std::vector<bool> inzones( zones.size(), false );
+  uintptr_t valids = 0, strideds = 0, still = 0;
+  double speedsum = 0;
+  
+  for (uintptr_t idx = 0; idx < frames; ++idx)
+    {
+      Mice const& mice = mices[idx];
+      valids += mice.valid;
+      strideds += mice.strided;
+      
+      // Speeds, from trajectory's centered differences
+      double speed = sqrt( mice.s.sqnorm() ) * fps;
+      speeds[idx] = speed;
+      speedsum += speed;
+      speedmax = std::max( speedmax, speed );
+      
+      if (idx > 0)
+        {
+          Mice const& prev = mices[idx-1];
+          distance += sqrt( (mice.p - prev.p).sqnorm() );
+          turning += fabs( atan2( prev.d.x*mice.d.y - prev.d.y*mice.d.x, prev.d * mice.d ) );
+        }
+      
+      // Immobility bouts: runs of slow frames lasting long enough
+      if (speed < immobilespeed)
+        still += 1;
+      if ((speed >= immobilespeed) or (idx == frames-1))
+        {
+          if (still >= immobileduration * fps)
+            { immobilebouts += 1; immobiletime += still / fps; }
+          still = 0;
+        }
+      
+      for (uintptr_t zdx = 0; zdx < zones.size(); ++zdx)
+        {
+          bool inside = zones[zdx].contains( mice.p );
+          if (inside and not inzones[zdx]) occupancy[zdx].entries += 1;
+          if (inside) occupancy[zdx].time += 1 / fps;
+          inzones[zdx] = inside;
+        }
+    }
+  
+  // Validity of analysed frames; stride interpolated ones are apart
+  validity = (frames > strideds) ? double(valids) / (frames - strideds) : 0;
+  strided = double(strideds) / frames;
+  speedmean = speedsum / frames;
+  
+  static double const quantiles[5] = {.1, .25, .5, .75, .9};
+  for (int qdx = 0; qdx < 5; ++qdx)
+    {
+      std::vector<double>::iterator nth = speeds.begin() + uintptr_t( quantiles[qdx] * (frames-1) + .5 );
+      std::nth_element( speeds.begin(), nth, speeds.end() );
+      speedquantiles[qdx] = *nth;
+    }
+}
+
+void
+Metrics::dump( std::ostream& sink ) const
+{
+  sink << "metric,value\n"
+       << "frames," << frames << '\n'
+       << "duration," << duration << '\n'
+       << "validity," << validity << '\n'
+       << "strided," << strided << '\n'
+       << "distance," << distance << '\n'
+       << "speed_mean," << speedmean << '\n'
+       << "speed_max," << speedmax << '\n'
+       << "speed_p10," << speedquantiles[0] << '\n'
+       << "speed_p25," << speedquantiles[1] << '\n'
+       << "speed_p50," << speedquantiles[2] << '\n'
+       << "speed_p75," << speedquantiles[3] << '\n'
+       << "speed_p90," << speedquantiles[4] << '\n'
+       << "immobility_speed," << immobilespeed << '\n'
+       << "immobility_bouts," << immobilebouts << '\n'
+       << "immobility_time," << immobiletime << '\n'
+       << "turning," << turning << '\n'
+       << "turning_rate," << (duration ? turning / duration : 0) << '\n';
+  for (uintptr_t zdx = 0; zdx < occupancy.size(); ++zdx)
+    {
+      sink << "zone_time:" << zones[zdx].name << ',' << occupancy[zdx].time << '\n'
+           << "zone_entries:" << zones[zdx].name << ',' << occupancy[zdx].entries << '\n';
+    }
+}
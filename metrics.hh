@@ -0,0 +1,55 @@
+#ifndef __METRICS_HH__
+#define __METRICS_HH__
+
+#include <analysis.hh>
+#include <geometry.hh>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+/* Zone: named polygon, in frame pixel coordinates (as crop and clicks) */
+struct Zone
+{
+  Zone( std::string const& _name ) : name(_name), polygon() {}
+  
+  bool contains( Point<double> const& p ) const;
+  
+  std::string                 name;
+  std::vector< Point<double> > polygon;
+};
+
+/* Metrics: behaviour summaries derived from a reconstructed trajectory
+ * (Analyser::trajectory must have run), computed in a single pass.
+ * Distances are in pixels, durations in seconds, angles in radians.
+ */
+struct Metrics
+{
+  Metrics();
+  
+  /* loadzones: one zone per line, "<name> <x>,<y> <x>,<y> <x>,<y> ..."
+   * ('#' starts comments) */
+  void loadzones( std::istream& source );
+  
+  void compute( std::vector<Mice> const& mices, double fps );
+  void dump( std::ostream& sink ) const;
+  
+  struct Ouch {};
+  
+  // Parameters
+  std::vector<Zone> zones;
+  double            immobilespeed;    /* px/s */
+  double            immobileduration; /* s */
+  
+  // Results
+  uintptr_t frames;
+  double    duration, validity, strided, distance;
+  double    speedmean, speedmax, speedquantiles[5];
+  uintptr_t immobilebouts;
+  double    immobiletime;
+  double    turning;
+  struct Occupancy { Occupancy() : time(), entries() {} double time; uintptr_t entries; };
+  std::vector<Occupancy> occupancy;
+};
+
+#endif /* __METRICS_HH__ */
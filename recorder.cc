@@ -0,0 +1,99 @@
+#include <recorder.hh>
+#include <algorithm>
+
+Recorder::Recorder( uintptr_t _depth, bool _dropping )
+  : dropped(0)
+  , writer()
+  , ring( std::max<uintptr_t>( _depth, 1 ) )
+  , head(0)
+  , count(0)
+  , dropping(_dropping)
+  , closing(false)
+{}
+
+Recorder::~Recorder()
+{
+  release();
+}
+
+bool
+Recorder::open( std::string const& path, double fps, cv::Size size, bool color )
+{
+  if (isOpened())
+    return true;
+  if (not writer.open( path, CV_FOURCC('M','J','P','G'), fps, size, color ))
+    return false;
+  head = count = dropped = 0;
+  closing = false;
+  thread = std::thread( &Recorder::encode, this );
+  return true;
+}
+
+void
+Recorder::push( cv::Mat const& frame, FramePool::Handle const& held )
+{
+  uintptr_t slot;
+  {
+    std::unique_lock<std::mutex> lock( mutex );
+    if (count >= ring.size())
+      {
+        if (dropping) { dropped += 1; return; }
+        freed.wait( lock, [this] { return count < ring.size(); } );
+      }
+    slot = (head + count) % ring.size();
+  }
+  /* The encoder never touches slots past head+count, so the copy can
+   * proceed unlocked; buffers are reused once allocated. */
+  if (held and held.mat().data == frame.data)
+    ring[slot].held = held;
+  else
+    frame.copyTo( ring[slot].copy );
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    count += 1;
+  }
+  ready.notify_one();
+}
+
+void
+Recorder::encode()
+{
+  for (;;)
+    {
+      uintptr_t slot;
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        ready.wait( lock, [this] { return count or closing; } );
+        if (not count) break; /* closing and drained */
+        slot = head;
+      }
+      Entry& entry = ring[slot];
+      if (entry.held)
+        {
+          writer << entry.held.mat();
+          entry.held = FramePool::Handle(); /* back to the pool */
+        }
+      else
+        writer << entry.copy;
+      {
+        std::lock_guard<std::mutex> lock( mutex );
+        head = (head + 1) % ring.size();
+        count -= 1;
+      }
+      freed.notify_one();
+    }
+}
+
+void
+Recorder::release()
+{
+  if (not isOpened())
+    return;
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    closing = true;
+  }
+  ready.notify_one();
+  thread.join();
+  writer.release();
+}
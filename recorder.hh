@@ -0,0 +1,52 @@
+#ifndef __RECORDER_HH__
+#define __RECORDER_HH__
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/videoio.hpp>
+#include <framepool.hh>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+/* Recorder: encodes frames on a background thread.
+ *
+ * Frames are queued in a bounded ring which the encoder thread drains:
+ * pooled frames are queued by handle, others are copied into reusable
+ * buffers. When the ring is full, frames are either dropped (and
+ * counted) or the caller blocks until a slot frees up.
+ */
+struct Recorder
+{
+  Recorder( uintptr_t _depth, bool _dropping );
+  ~Recorder();
+
+  bool open( std::string const& path, double fps, cv::Size size, bool color = true );
+  bool isOpened() const { return thread.joinable(); }
+  /* push: queues `frame`; `held` may hold the pooled buffer of frame */
+  void push( cv::Mat const& frame, FramePool::Handle const& held = FramePool::Handle() );
+  void release();
+
+  uintptr_t dropped;
+
+private:
+  void encode();
+
+  cv::VideoWriter          writer;
+  struct Entry
+  {
+    cv::Mat           copy;
+    FramePool::Handle held;
+  };
+  
+  std::vector<Entry>       ring;
+  uintptr_t                head, count;
+  bool                     dropping, closing;
+  std::mutex               mutex;
+  std::condition_variable  ready, freed;
+  std::thread              thread;
+};
+
+#endif /* __RECORDER_HH__ */
@@ -0,0 +1,224 @@
+#include <sequence.hh>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace
+{
+  bool isdir( std::string const& path )
+  {
+    struct stat st;
+    return stat( path.c_str(), &st ) == 0 and S_ISDIR(st.st_mode);
+  }
+  
+  bool isfile( std::string const& path )
+  {
+    struct stat st;
+    return stat( path.c_str(), &st ) == 0 and S_ISREG(st.st_mode);
+  }
+  
+  bool isimage( std::string const& name )
+  {
+    static char const* exts[] = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".pgm", ".ppm"};
+    uintptr_t idx = name.rfind('.');
+    if (idx >= name.size()) return false;
+    std::string ext( name.substr(idx) );
+    for (char& ch : ext) ch = tolower(ch);
+    for (char const* e : exts) if (ext == e) return true;
+    return false;
+  }
+  
+  /* numbering: whether printf pattern `source` holds exactly one
+   * conversion, an integer one (flags, width and precision allowed) */
+  bool numbering( std::string const& source )
+  {
+    uintptr_t conversions = 0;
+    for (uintptr_t idx = 0; idx < source.size(); ++idx)
+      {
+        if (source[idx] != '%') continue;
+        if (++idx < source.size() and source[idx] == '%') continue; /* literal */
+        while (idx < source.size() and strchr( "-+ #0123456789.", source[idx] )) ++idx;
+        if (idx >= source.size() or not strchr( "diuxXo", source[idx] )) return false;
+        conversions += 1;
+      }
+    return conversions == 1;
+  }
+  
+  /* natural: name order where digit runs compare numerically (img9 < img10) */
+  bool natural( std::string const& a, std::string const& b )
+  {
+    uintptr_t ia = 0, ib = 0;
+    while (ia < a.size() and ib < b.size())
+      {
+        if (isdigit(a[ia]) and isdigit(b[ib]))
+          {
+            uintptr_t ea = ia, eb = ib;
+            while (ea < a.size() and a[ea] == '0') ++ea;
+            while (eb < b.size() and b[eb] == '0') ++eb;
+            uintptr_t sa = ea, sb = eb;
+            while (ea < a.size() and isdigit(a[ea])) ++ea;
+            while (eb < b.size() and isdigit(b[eb])) ++eb;
+            if ((ea-sa) != (eb-sb)) return (ea-sa) < (eb-sb);
+            int cmp = a.compare( sa, ea-sa, b, sb, eb-sb );
+            if (cmp) return cmp < 0;
+            ia = ea; ib = eb;
+          }
+        else if (a[ia] != b[ib])
+          return a[ia] < b[ib];
+        else
+          { ++ia; ++ib; }
+      }
+    return (a.size() - ia) < (b.size() - ib);
+  }
+}
+
+bool
+SequenceFrameIterator::accept( std::string const& source )
+{
+  return source.find('%') < source.size() or isdir( source );
+}
+
+SequenceFrameIterator::SequenceFrameIterator( std::string const& source, uintptr_t _stop, double _fps, uintptr_t lookahead, uintptr_t spare, uintptr_t decoders )
+  : FrameIterator()
+  , paths()
+  , slots( std::max<uintptr_t>( lookahead, 1 ) )
+  , issued(0)
+  , generation(0)
+  , closing(false)
+{
+  fps = _fps;
+  
+  if (isdir( source ))
+    {
+      if (DIR* dp = opendir( source.c_str() ))
+        {
+          while (struct dirent* ep = readdir( dp ))
+            if (isimage( ep->d_name )) paths.push_back( ep->d_name );
+          closedir( dp );
+        }
+      std::sort( paths.begin(), paths.end(), natural );
+      std::string dir( source );
+      if (dir[dir.size()-1] != '/') dir += '/';
+      for (std::string& path : paths) path.insert( 0, dir );
+    }
+  else
+    {
+      if (not numbering( source )) throw "Bad image sequence pattern (expecting one integer conversion, e.g. %05d)";
+      std::vector<char> buf( source.size() + 64 );
+      for (uintptr_t first = 0; first < 2 and paths.empty(); ++first)
+        for (uintptr_t num = first;; ++num)
+          {
+            snprintf( &buf[0], buf.size(), source.c_str(), int(num) );
+            if (not isfile( &buf[0] )) break;
+            paths.push_back( &buf[0] );
+          }
+    }
+  
+  if (paths.empty()) throw "Error when reading image sequence (no images)";
+  if (paths.size() > _stop) paths.resize( _stop );
+  
+  {
+    cv::Mat first = cv::imread( paths[0], cv::IMREAD_ANYCOLOR );
+    if (first.empty()) throw "Error when reading image";
+    pool = FramePool::create( slots.size() + spare, first.rows, first.cols, first.type() );
+  }
+  
+  if (not decoders) decoders = std::thread::hardware_concurrency();
+  uintptr_t count = std::min<uintptr_t>( std::max<uintptr_t>( decoders, 1 ), slots.size() );
+  for (uintptr_t idx = 0; idx < count; ++idx)
+    workers.push_back( std::thread( &SequenceFrameIterator::decode, this ) );
+}
+
+SequenceFrameIterator::~SequenceFrameIterator()
+{
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    closing = true;
+    for (Slot& slot : slots) slot.image = FramePool::Handle();
+  }
+  consumed.notify_all();
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+void
+SequenceFrameIterator::decode()
+{
+  std::vector<uint8_t> bytes;
+  std::unique_lock<std::mutex> lock( mutex );
+  for (;;)
+    {
+      // A slot is free once the frame `lookahead` before has been consumed
+      consumed.wait( lock, [this] { return closing or (issued < paths.size() and issued < idx + slots.size()); } );
+      if (closing) break;
+      uintptr_t pos = issued++, gen = generation;
+      
+      lock.unlock();
+      FramePool::Handle image = pool->acquire();
+      {
+        // File bytes go to a reused buffer, pixels straight to the pool
+        std::ifstream source( paths[pos].c_str(), std::ios::binary );
+        source.seekg( 0, std::ios::end );
+        bytes.resize( std::max<std::streamoff>( source.tellg(), 1 ) );
+        source.seekg( 0, std::ios::beg );
+        if (source.read( (char*)&bytes[0], bytes.size() ))
+          {
+            cv::Mat dst = image.mat();
+            // On failure, dst may still be the recycled (stale) buffer
+            if (cv::imdecode( cv::Mat( 1, bytes.size(), CV_8UC1, &bytes[0] ), cv::IMREAD_ANYCOLOR, &dst ).empty())
+              image.mat() = cv::Mat();
+            else
+              pool->adopt( image, dst );
+          }
+        else
+          image.mat() = cv::Mat();
+      }
+      lock.lock();
+      
+      if (gen != generation) continue; /* seeked away */
+      Slot& slot = slots[pos % slots.size()];
+      slot.image = image;
+      slot.pos = pos;
+      slot.ready = true;
+      decoded.notify_all();
+    }
+}
+
+bool
+SequenceFrameIterator::next()
+{
+  std::unique_lock<std::mutex> lock( mutex );
+  if (idx >= paths.size()) { frame = cv::Mat(); return false; }
+  
+  Slot& slot = slots[idx % slots.size()];
+  decoded.wait( lock, [&] { return slot.ready and slot.pos == idx; } );
+  buffer = slot.image;
+  frame = buffer.mat();
+  slot.image = FramePool::Handle();
+  slot.ready = false;
+  if (frame.empty()) throw "Error when reading image";
+  
+  idx += 1;
+  lock.unlock();
+  consumed.notify_all();
+  return true;
+}
+
+bool
+SequenceFrameIterator::seek( uintptr_t pos )
+{
+  if (pos >= paths.size()) return false;
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    generation += 1;
+    for (Slot& slot : slots) { slot.ready = false; slot.image = FramePool::Handle(); }
+    idx = issued = pos;
+  }
+  consumed.notify_all();
+  return true;
+}
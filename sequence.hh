@@ -0,0 +1,53 @@
+#ifndef __SEQUENCE_HH__
+#define __SEQUENCE_HH__
+
+#include <analysis.hh>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+/* SequenceFrameIterator: iteration over numbered image files
+ *
+ * The source is either a directory (image files taken in natural name
+ * order) or a printf-style pattern (e.g. "run/img%05d.png", numbered
+ * from 0 or 1). Images are decoded by `decoders` prefetching threads
+ * (0: one per CPU), at most `lookahead` frames ahead of the consumer,
+ * and delivered in order.
+ * Decoding targets recycled pool buffers, shaped after the first image;
+ * `spare` extra buffers are available to consumers holding frames.
+ */
+struct SequenceFrameIterator : public FrameIterator
+{
+  SequenceFrameIterator( std::string const& source, uintptr_t _stop, double _fps, uintptr_t lookahead, uintptr_t spare, uintptr_t decoders );
+  ~SequenceFrameIterator();
+
+  static bool accept( std::string const& source );
+  
+  virtual bool next() override;
+  virtual bool seek( uintptr_t pos ) override;
+
+private:
+  struct Slot
+  {
+    Slot() : image(), pos(), ready(false) {}
+    FramePool::Handle image;
+    uintptr_t         pos;
+    bool              ready;
+  };
+  
+  void decode();
+  
+  std::vector<std::string> paths;
+  std::vector<Slot>        slots;
+  uintptr_t                issued;     /* next frame to decode */
+  uintptr_t                generation; /* bumped on seek, voids in-flight decodes */
+  bool                     closing;
+  std::mutex               mutex;
+  std::condition_variable  decoded, consumed;
+  std::vector<std::thread> workers;
+};
+
+#endif /* __SEQUENCE_HH__ */
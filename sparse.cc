@@ -0,0 +1,125 @@
+#include <sparse.hh>
+#include <algorithm>
+#include <cstring>
+
+SparseWriter::SparseWriter( std::string const& path, uintptr_t width, uintptr_t height, Analyser::ROI const& roi, unsigned _floor, double fps )
+  : floor(_floor)
+  , sink( path.c_str(), std::ios::binary )
+  , header()
+  , offsets()
+  , buffer()
+  , current()
+  , runpos(0)
+  , running(false)
+{
+  if (width > 0x10000 or height > 0x10000) throw "Frame too large for sparse store";
+  memcpy( header.magic, SparseStore::magic(), 4 );
+  header.version = SparseStore::version;
+  header.width = width; header.height = height;
+  header.floor = floor;
+  header.x0 = roi.x0; header.x1 = roi.x1; header.y0 = roi.y0; header.y1 = roi.y1;
+  header.fps = fps;
+  // Final header is written on close
+  sink.write( (char const*)&header, sizeof (header) );
+  if (not sink) throw "Error when writing sparse store";
+  offsets.push_back( sizeof (header) );
+}
+
+SparseWriter::~SparseWriter()
+{
+  // Not closed: left with its initial header, which readers reject
+  if (sink.is_open()) sink.close();
+}
+
+void
+SparseWriter::begin()
+{
+  buffer.clear();
+  running = false;
+}
+
+void
+SparseWriter::open( uintptr_t x, uintptr_t y )
+{
+  flush();
+  runpos = buffer.size();
+  buffer.resize( runpos + sizeof (SparseStore::Run) );
+  current.y = y; current.x = x; current.length = 0;
+  running = true;
+}
+
+/* flush: writes current run header in place */
+void
+SparseWriter::flush()
+{
+  if (running)
+    memcpy( &buffer[runpos], &current, sizeof (current) );
+}
+
+void
+SparseWriter::end()
+{
+  flush();
+  running = false;
+  sink.write( (char const*)buffer.data(), buffer.size() );
+  if (not sink) throw "Error when writing sparse store";
+  offsets.push_back( offsets.back() + buffer.size() );
+  header.frames += 1;
+}
+
+void
+SparseWriter::close()
+{
+  if (not sink.is_open()) return;
+  // Offsets go 8-byte aligned, for direct use from the mapping
+  static char const padding[8] = {};
+  header.index = (offsets.back() + 7) / 8 * 8;
+  sink.write( padding, header.index - offsets.back() );
+  sink.write( (char const*)offsets.data(), offsets.size() * sizeof (uint64_t) );
+  sink.seekp( 0 );
+  sink.write( (char const*)&header, sizeof (header) );
+  sink.close();
+  if (not sink) throw "Error when writing sparse store";
+}
+
+SparseReader::SparseReader( std::string const& path )
+  : file( path )
+  , header()
+  , offsets()
+{
+  if (file.size < sizeof (header)) throw "Error when reading sparse store";
+  memcpy( &header, file.base, sizeof (header) );
+  if (memcmp( header.magic, SparseStore::magic(), 4 ) != 0 or header.version != SparseStore::version)
+    throw "Not a sparse store";
+  // An unclosed store (interrupted pass #1) still has its initial header
+  if ((header.frames == 0) or (header.index < sizeof (header)) or (header.index % 8) or
+      (header.index + (header.frames + 1) * sizeof (uint64_t)) > file.size)
+    throw "Truncated sparse store";
+  offsets = (uint64_t const*)(file.base + header.index);
+  if ((offsets[0] != sizeof (header)) or (offsets[header.frames] > header.index))
+    throw "Corrupted sparse store";
+  file.willneed( sizeof (header), header.index - sizeof (header) );
+}
+
+void
+SparseReader::moments( uintptr_t frame, Analyser::ROI const& roi, unsigned threshold, Moments& m ) const
+{
+  uint8_t const* ptr = file.base + offsets[frame];
+  uint8_t const* end = file.base + offsets[frame+1];
+  while (ptr < end)
+    {
+      SparseStore::Run run;
+      memcpy( &run, ptr, sizeof (run) );
+      uint8_t const* lums = ptr + sizeof (run);
+      ptr = lums + run.length;
+      if ((run.y < roi.y0) or (run.y >= roi.y1))
+        continue;
+      uintptr_t x0 = std::max<uintptr_t>( run.x, roi.x0 ), x1 = std::min<uintptr_t>( run.x + run.length, roi.x1 );
+      for (uintptr_t x = x0; x < x1; ++x)
+        {
+          uint8_t l = lums[x - run.x];
+          if (l < threshold) continue;
+          m.add( x, run.y, l );
+        }
+    }
+}
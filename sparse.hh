@@ -0,0 +1,93 @@
+#ifndef __SPARSE_HH__
+#define __SPARSE_HH__
+
+#include <analysis.hh>
+#include <mapped.hh>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+/* Sparse foreground store: for each frame, the pixels whose deviation
+ * luminance reaches a floor threshold, as runs of consecutive pixels
+ * on a row. Moments for any threshold above floor, and any region
+ * within the one analysed when storing, can be recomputed from it.
+ *
+ * Layout: Header, then frames' runs (run header followed by one
+ * luminance byte per pixel), padded to 8 bytes, then the offsets of
+ * frames (frames + 1 entries, the last one being the end of runs).
+ */
+struct SparseStore
+{
+  struct Header
+  {
+    char     magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t floor, reserved;
+    uint32_t x0, x1, y0, y1; /* analysed region */
+    double   fps;
+    uint64_t frames;
+    uint64_t index;
+  };
+  
+  struct Run
+  {
+    uint16_t y, x, length;
+  };
+  
+  static char const* magic() { return "MTFG"; }
+  enum { version = 2 };
+};
+
+struct SparseWriter
+{
+  SparseWriter( std::string const& path, uintptr_t width, uintptr_t height, Analyser::ROI const& roi, unsigned _floor, double fps );
+  ~SparseWriter();
+  
+  void begin();
+  void pixel( uintptr_t x, uintptr_t y, uint8_t l )
+  {
+    if (not running or (y != current.y) or (x != uintptr_t(current.x) + current.length) or (current.length == 0xffff))
+      open( x, y );
+    buffer.push_back( l );
+    current.length += 1;
+  }
+  void end();
+  void close();
+  
+  unsigned floor;
+  
+private:
+  void open( uintptr_t x, uintptr_t y );
+  void flush();
+  
+  std::ofstream          sink;
+  SparseStore::Header    header;
+  std::vector<uint64_t>  offsets;
+  std::vector<uint8_t>   buffer;
+  SparseStore::Run       current;
+  uintptr_t              runpos;
+  bool                   running;
+};
+
+struct SparseReader
+{
+  SparseReader( std::string const& path );
+  
+  uintptr_t frames() const { return header.frames; }
+  /* covers: whether `roi` lies within the region analysed when storing */
+  bool covers( Analyser::ROI const& roi ) const
+  {
+    return roi.x0 >= header.x0 and roi.x1 <= header.x1 and roi.y0 >= header.y0 and roi.y1 <= header.y1;
+  }
+  /* moments: accumulates stored pixels of `frame` within `roi` and
+   * reaching `threshold` */
+  void moments( uintptr_t frame, Analyser::ROI const& roi, unsigned threshold, Moments& m ) const;
+  
+  MappedFile           file;
+  SparseStore::Header  header;
+  uint64_t const*      offsets;
+};
+
+#endif /* __SPARSE_HH__ */
@@ -0,0 +1,170 @@
+#include <spool.hh>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <cstdio>
+#include <dirent.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  /* lock: takes the spool directory lock for the life of the process
+   * (released by the system when it exits)
+   * returns: false if another daemon holds it
+   */
+  bool lock( std::string const& path )
+  {
+#ifdef _WIN32
+    HANDLE fh = CreateFileA( path.c_str(), GENERIC_WRITE, 0, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0 );
+    if (fh != INVALID_HANDLE_VALUE) return true;
+    if (GetLastError() == ERROR_SHARING_VIOLATION) return false;
+    throw "Error when creating spool lock";
+#else
+    int fd = open( path.c_str(), O_WRONLY | O_CREAT, 0644 );
+    if (fd < 0) throw "Error when creating spool lock";
+    if (flock( fd, LOCK_EX | LOCK_NB ) == 0) return true;
+    close( fd );
+    return false;
+#endif
+  }
+}
+
+Spool::Spool( std::string const& _dir, uintptr_t _workers )
+  : dir(_dir)
+  , workers( std::max<uintptr_t>( _workers, 1 ) )
+  , mutex()
+{}
+
+void
+Spool::serve( Job const& job )
+{
+  if (not lock( dir + "/.lock" ))
+    throw "Spool directory served by another daemon";
+  
+  // Requeuing jobs interrupted by a previous daemon
+  std::vector<std::string> names;
+  if (DIR* dp = opendir( dir.c_str() ))
+    {
+      while (struct dirent* ep = readdir( dp ))
+        {
+          std::string entry( ep->d_name );
+          uintptr_t idx = entry.rfind('.');
+          if (idx < entry.size() and entry.substr(idx) == ".run")
+            names.push_back( entry.substr(0,idx) );
+        }
+      closedir( dp );
+    }
+  else
+    throw "Error when opening spool directory";
+  
+  for (std::string const& name : names)
+    std::rename( path(name, ".run").c_str(), path(name, ".job").c_str() );
+
+  std::cerr << "Serving " << dir << " with " << workers << " workers\n";
+  
+  std::vector<std::thread> threads;
+  for (uintptr_t idx = 0; idx < workers; ++idx)
+    threads.push_back( std::thread( &Spool::work, this, std::cref(job) ) );
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+void
+Spool::work( Job const& job )
+{
+  for (std::string name;;)
+    {
+      if (claim( name ))
+        run( name, job );
+      else
+        std::this_thread::sleep_for( std::chrono::seconds(1) );
+    }
+}
+
+/* claim: grabs the oldest (by name) pending job
+ * returns: true if a job was claimed
+ */
+bool
+Spool::claim( std::string& name )
+{
+  std::vector<std::string> names;
+  if (DIR* dp = opendir( dir.c_str() ))
+    {
+      while (struct dirent* ep = readdir( dp ))
+        {
+          std::string entry( ep->d_name );
+          uintptr_t idx = entry.rfind('.');
+          if (idx < entry.size() and entry.substr(idx) == ".job")
+            names.push_back( entry.substr(0,idx) );
+        }
+      closedir( dp );
+    }
+  std::sort( names.begin(), names.end() );
+  
+  for (std::string const& candidate : names)
+    {
+      if (std::rename( path(candidate, ".job").c_str(), path(candidate, ".run").c_str() ) != 0)
+        continue; /* claimed by someone else */
+      name = candidate;
+      return true;
+    }
+  return false;
+}
+
+void
+Spool::run( std::string const& name, Job const& job )
+{
+  report( name, "started" );
+  
+  Args args;
+  {
+    std::ifstream source( path(name, ".run").c_str() );
+    for (std::string line; std::getline( source, line );)
+      {
+        if (line.size() and line[line.size()-1] == '\r')
+          line.resize(line.size()-1);
+        if (line.empty() or line[0] == '#')
+          continue;
+        args.push_back( line );
+      }
+  }
+  
+  std::ofstream log( path(name, ".log").c_str() );
+  bool success = false;
+  try
+    {
+      success = job( args, log );
+    }
+  catch (char const* what)
+    {
+      log << "---\n" << what << '\n';
+    }
+  catch (...)
+    {
+      log << "---\nAnalysis failure\n";
+    }
+  log << (success ? "Done\n" : "Failed\n");
+  log.close();
+  
+  // Outcome of a previous job of the same name is replaced (rename
+  // does not overwrite on Windows, leaving the job to run again)
+  std::string const outcome( path(name, success ? ".done" : ".fail") );
+  std::remove( outcome.c_str() );
+  std::rename( path(name, ".run").c_str(), outcome.c_str() );
+  report( name, success ? "done" : "failed" );
+}
+
+void
+Spool::report( std::string const& name, char const* what )
+{
+  std::lock_guard<std::mutex> lock( mutex );
+  std::cerr << "[" << name << "] " << what << std::endl;
+}
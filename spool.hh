@@ -0,0 +1,42 @@
+#ifndef __SPOOL_HH__
+#define __SPOOL_HH__
+
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+/* Spool: serves jobs dropped in a spool directory.
+ *
+ * A job is a `<name>.job` text file holding one command line argument
+ * per line (empty lines and lines starting with '#' are ignored). A
+ * worker claims a job by renaming it `<name>.run`, logs its progress in
+ * `<name>.log`, and finally renames it `<name>.done` or `<name>.fail`.
+ * Claiming is an atomic rename, so that several workers may share the
+ * directory; a lock file (`.lock`) keeps other daemons away, so that
+ * jobs found running at startup are known to be interrupted ones.
+ */
+struct Spool
+{
+  typedef std::vector<std::string> Args;
+  typedef std::function<bool (Args const&, std::ostream&)> Job;
+
+  Spool( std::string const& _dir, uintptr_t _workers );
+
+  void serve( Job const& job );
+
+private:
+  bool claim( std::string& name );
+  void run( std::string const& name, Job const& job );
+  void work( Job const& job );
+  void report( std::string const& name, char const* what );
+  std::string path( std::string const& name, char const* ext ) const { return dir + '/' + name + ext; }
+
+  std::string dir;
+  uintptr_t   workers;
+  std::mutex  mutex;
+};
+
+#endif /* __SPOOL_HH__ */
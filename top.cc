@@ -1,5 +1,12 @@
 #include <analysis.hh>
+#include <mapped.hh>
+#include <metrics.hh>
+#include <recorder.hh>
+#include <sequence.hh>
+#include <sparse.hh>
+#include <spool.hh>
 #include <geometry.hh>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -7,6 +14,8 @@
 #include <limits>
 #include <cmath>
 #include <cstdarg>
+#include <memory>
+#include <thread>
 #include <opencv2/highgui.hpp>
 #include <opencv2/videoio.hpp>
 #include <opencv2/opencv.hpp>
@@ -28,36 +37,46 @@ mouse_callback( int event, int x, int y, int flags, Analyser* analyser )
 
 struct VideoFrameIterator : public FrameIterator
 {
-  VideoFrameIterator( std::string path, uintptr_t _stop ) 
+  VideoFrameIterator( std::string path, uintptr_t _stop, uintptr_t buffers ) 
     : FrameIterator()
     , capture( path.c_str() )
     , stop( _stop )
-    , fps(capture.get(CV_CAP_PROP_FPS))
   {
     if (not capture.isOpened()) throw "Error when reading avi file";
-  }
-
-  double sec() const { return double(idx) / fps; }
-
-  void progress( std::ostream& term ) const
-  {
-    uintptr_t ufps = fps;
-    if (idx % ufps)
-      return;
-    term << "\e[G\e[KDone: " << (idx / ufps) << "s ";
-    term.flush();
+    fps = capture.get(CV_CAP_PROP_FPS);
+    pool = FramePool::create( buffers, capture.get(CV_CAP_PROP_FRAME_HEIGHT), capture.get(CV_CAP_PROP_FRAME_WIDTH), CV_8UC3 );
   }
 
   virtual bool next() override
   {
+     buffer = FramePool::Handle();
+     buffer = pool->acquire();
+     frame = buffer.mat();
      capture >> frame;
      if (++idx >= stop) { /* drain video */ while (not frame.empty()) { capture >> frame; } }
+     pool->adopt( buffer, frame );
      return not frame.empty();
   }
 
+  virtual bool skip() override
+  {
+     if (++idx >= stop) return false;
+     return capture.grab();
+  }
+
+  virtual double msec() const override { return capture.get( CV_CAP_PROP_POS_MSEC ); }
+
+  /* seek: the capture backend restarts decoding from the keyframe
+   * preceding `pos`, and decodes up to it */
+  virtual bool seek( uintptr_t pos ) override
+  {
+    if (pos >= stop or not capture.set( CV_CAP_PROP_POS_FRAMES, pos )) return false;
+    idx = pos;
+    return true;
+  }
+
   cv::VideoCapture capture;
   uintptr_t stop;
-  double fps;
 };
 
 struct RangeBGSel : public Analyser::BGSel
@@ -78,19 +97,93 @@ struct RatioBGSel : public Analyser::BGSel
   uintptr_t period;
 };
 
+/* FrameIndex: presentation times (ms) of all frames, gathered during
+ * pass #0 and cached next to results, for jumping to frames and times
+ * without replaying the video.
+ */
+struct FrameIndex
+{
+  FrameIndex() : msecs() {}
+  
+  void add( double msec ) { msecs.push_back( msec ); }
+  
+  /* frame: first frame presented at or after `sec` */
+  uintptr_t frame( double sec, double fps ) const
+  {
+    if (msecs.empty()) return std::max( sec, 0. ) * fps;
+    return std::lower_bound( msecs.begin(), msecs.end(), sec*1000 ) - msecs.begin();
+  }
+  
+  bool save( std::string const& path ) const
+  {
+    std::ofstream sink( path.c_str() );
+    sink << "frame,msec\n";
+    for (uintptr_t idx = 0; idx < msecs.size(); ++idx)
+      sink << idx << ',' << msecs[idx] << '\n';
+    return bool(sink);
+  }
+  
+  bool load( std::string const& path, uintptr_t frames )
+  {
+    std::ifstream source( path.c_str() );
+    std::string line;
+    if (not std::getline( source, line )) return false;
+    msecs.clear();
+    for (uintptr_t idx; std::getline( source, line ) and (idx = strtoul( line.c_str(), 0, 10 )) == msecs.size();)
+      msecs.push_back( strtod( line.c_str() + line.find(',') + 1, 0 ) );
+    if (msecs.size() == frames) return true;
+    msecs.clear(); // stale
+    return false;
+  }
+  
+  std::vector<double> msecs;
+};
+
 struct Operands
 {
   std::string video;
+  int raw[3];
+  double fps;
+  uintptr_t prefetch;
   uintptr_t framestop;
   double keylogspeed;
+  uintptr_t recqueue;
+  bool recdrop;
   bool interactive;
+  bool reanalyse;
+  unsigned fgfloor;
+  bool fgreplay;
+  bool csv;
+  bool metrics;
+  std::vector<Zone> zones;
+  double immobility[2]; /* negative: unset */
+  std::string spool;
+  uintptr_t jobs;
+  uintptr_t decoders; /* image sequence decoding threads (0: one per CPU) */
 
   Operands()
     : video()
+    , raw()
+    , fps(0)
+    , prefetch(16)
     , framestop(std::numeric_limits<uintptr_t>::max())
     , keylogspeed(0.0)
+    , recqueue(16)
+    , recdrop(false)
     , interactive(true)
-  {}
+    , reanalyse(false)
+    , fgfloor(0)
+    , fgreplay(false)
+    , csv(true)
+    , metrics(false)
+    , zones()
+    , immobility()
+    , spool()
+    , jobs(std::max<uintptr_t>(std::thread::hardware_concurrency(), 1))
+    , decoders(0)
+  {
+    immobility[0] = immobility[1] = -1;
+  }
 };
 
 struct Params
@@ -201,6 +294,50 @@ struct Params
         return true;
       }
       
+    for (Param _("stride", "<frames>", "Analyse one frame out of <frames>, then refine intervals where mice moved (see strideerr)."); match(_);)
+      {
+        _ >> ancfg().stride;
+        if (ancfg().stride < 1) throw _;
+        return true;
+      }
+
+    for (Param _("strideerr", "<pixels>", "Maximum mice motion (position and size) across a stride for interpolating it rather than analysing it."); match(_);)
+      {
+        _ >> ancfg().strideerr;
+        return true;
+      }
+
+    for (Param _("raw", "<width>:<height>:<channels>", "Video is a headerless sequence of packed 8-bit frames (gray, BGR or BGRA: 1, 3 or 4 channels), read through a memory mapping."); match(_);)
+      {
+        char sep = ':';
+        for (int idx = 0; idx < 3; ++idx) {
+          if (sep != ':') throw _;
+          _ >> opcfg().raw[idx] >> sep;
+        }
+        if (sep != '\0' or opcfg().raw[0] <= 0 or opcfg().raw[1] <= 0 or not (opcfg().raw[2] == 1 or opcfg().raw[2] == 3 or opcfg().raw[2] == 4)) throw _;
+        return true;
+      }
+
+    for (Param _("fps", "<rate>", "Frame rate, overriding video metadata (image sequences and raw videos have none, and default to 25)."); match(_);)
+      {
+        _ >> opcfg().fps;
+        if (not (opcfg().fps > 0)) throw _;
+        return true;
+      }
+
+    for (Param _("prefetch", "<frames>", "Image sequences (directory or printf-style pattern): frames decoded ahead, in parallel."); match(_);)
+      {
+        _ >> opcfg().prefetch;
+        if (opcfg().prefetch < 1) throw _;
+        return true;
+      }
+
+    for (Param _("tiles", "<size>", "Split analysed region in <size>x<size> tiles and skip tiles that cannot reach threshold (0: no tiles)."); match(_);)
+      {
+        _ >> ancfg().tile;
+        return true;
+      }
+
     for (Param _("stop", "<bound>", "Maximum frames considered."); match(_);)
       {
         _ >> opcfg().framestop;
@@ -213,12 +350,100 @@ struct Params
         return true;
       }
 
-    for (Param _("interactive", "[Y/n]", "launch graphical interface (play, crop, keyog...)"); match(_);)
+    for (Param _("recqueue", "<frames>", "Frames buffered for the background recording encoder ('r' key)."); match(_);)
+      {
+        _ >> opcfg().recqueue;
+        return true;
+      }
+
+    for (Param _("recdrop", "[y/N]", "Drop recorded frames when the recording queue is full (else playback waits for the encoder)."); match(_);)
+      {
+        _ >> opcfg().recdrop;
+        return true;
+      }
+
+    for (Param _("interactive", "[Y/n]", "launch graphical interface (play, crop, keyog, seek: <n>g frame, <n>t second, b back, n/p next/previous invalid...)"); match(_);)
       {
 	_ >> opcfg().interactive;
 	return true;
       }
     
+    for (Param _("reanalyse", "[y/N]", "Reload previous results (<video>.csv and <video>_bg.png) and only analyse again frames found invalid."); match(_);)
+      {
+        _ >> opcfg().reanalyse;
+        return true;
+      }
+
+    for (Param _("fgfloor", "<value>", "Store pixels whose deviation reaches <value> (below threshold) in <video>_fg.bin during pass #1, for fgreplay (0: none)."); match(_);)
+      {
+        _ >> opcfg().fgfloor;
+        return true;
+      }
+
+    for (Param _("fgreplay", "[y/N]", "Compute results from <video>_fg.bin (see fgfloor) with current threshold and crop (within the stored one), without decoding video (implies interactive:n)."); match(_);)
+      {
+        _ >> opcfg().fgreplay;
+        return true;
+      }
+
+    for (Param _("csv", "[Y/n]", "Write per frame results (<video>.csv)."); match(_);)
+      {
+        _ >> opcfg().csv;
+        return true;
+      }
+
+    for (Param _("metrics", "[y/N]", "Write behaviour summary metrics (<video>_metrics.csv)."); match(_);)
+      {
+        _ >> opcfg().metrics;
+        return true;
+      }
+
+    for (Param _("zones", "<file>", "Zone polygons for metrics, one per line: <name> <x>,<y> <x>,<y> <x>,<y>... (implies metrics)."); match(_);)
+      {
+        // Loaded now, so that a bad file fails before any analysis
+        std::ifstream source( _.args );
+        Metrics loaded;
+        try { if (not source) throw Metrics::Ouch(); loaded.loadzones( source ); }
+        catch (Metrics::Ouch const&)
+          {
+            // Reported by paramerror (i.e. in job logs too)
+            Param error( _ );
+            error.desc_help = "Error when reading zones file (missing, or malformed zone line).";
+            throw error;
+          }
+        opcfg().zones = loaded.zones;
+        opcfg().metrics = true;
+        return true;
+      }
+
+    for (Param _("immobility", "<speed>[:<seconds>]", "Metrics: slowest speed (pixels/s) of mobility, and shortest immobility bout (default 20:1)."); match(_);)
+      {
+        char sep = ':';
+        for (int idx = 0; idx < 2 and sep == ':'; ++idx)
+          {
+            char const* value = _.args;
+            _ >> opcfg().immobility[idx];
+            if (_.args == value or opcfg().immobility[idx] < 0) throw _;
+            _ >> sep;
+          }
+        if (sep != '\0') throw _;
+        return true;
+      }
+
+    for (Param _("spool", "<directory>", "Serve analysis jobs dropped in <directory> as <name>.job files (one argument per line)."); match(_);)
+      {
+        opcfg().spool = _.args;
+        if (opcfg().spool.empty()) throw _;
+        return true;
+      }
+
+    for (Param _("jobs", "<count>", "Maximum concurrent jobs when serving a spool directory (CPUs for image sequence decoding are shared among them)."); match(_);)
+      {
+        _ >> opcfg().jobs;
+        if (opcfg().jobs < 1) throw _;
+        return true;
+      }
+
     for (Param _("elongation", "<ratio>", "Minimum mice body elongation considered for orientation"); match(_);)
       {
         _ >> ancfg().minelongation;
@@ -255,130 +480,373 @@ void help(char const* appname, std::ostream& sink)
   } pp(sink, spacing);
 }
 
-int
-main( int argc, char** argv )
+struct GetParams : Params
 {
-  Analyser analyser;
-  Operands operands;
-
-  try
-    {
-      struct GetParams : Params
+  GetParams( char const* _self, Analyser& _analyser, Operands& _operands )
+    : self(_self), arg(), analyser(_analyser), operands(_operands), verbose(true)
+  {}
+  
+  /* parse: fills analyser and operands from command line arguments
+   * returns: false if help was requested
+   */
+  bool parse( char const* const* args )
+  {
+    analyser.args.push_back( self );
+    while (char const* ap = arg = *++args)
       {
-        GetParams( char const* _self, Analyser& _analyser, Operands& _operands )
-          : self(_self), arg(), analyser(_analyser), operands(_operands), verbose(true)
-        {}
-    
-        void parse( char** args )
-        {
-          analyser.args.push_back( self );
-          while (char const* ap = arg = *++args)
-            {
-              for (char const* h; (((h = argsof("help",ap)) and not *h) or ((h = argsof("--help",ap)) and not *h) or ((h = argsof("-h",ap)) and not *h));)
-                {
-                  help(self, std::cout);
-                  exit(0);
-                }
-          
-              analyser.args.push_back( ap );
-          
-              if (all())
-                continue;
-              
-              if (operands.video.size())
-                { throw Param("error", " one video at a time please...", ""); }
-              operands.video = ap;
-            }
-          
-          if (not operands.video.size())
-            { throw Param("error", " no video given...", ""); }
-        }
-        virtual Analyser& ancfg() override { return analyser; }
-        virtual Operands& opcfg() override { return operands; }
-        virtual bool match(Param& param) override
-        {
-          char const* a = arg;
-          for (char const *b = param.name; *b; ++a, ++b)
-            { if (*a != *b) return false; }
-          if (*a++ != ':') return false;
-          param.set_args(a);
-          if (verbose)
-            { std::cerr << "[" << param.name << "] " << param.desc_help << "\n  " << a << " (" << param.args_help << ")\n"; }
-          return true;
-        }
+        for (char const* h; (((h = argsof("help",ap)) and not *h) or ((h = argsof("--help",ap)) and not *h) or ((h = argsof("-h",ap)) and not *h));)
+          return false;
+        
+        analyser.args.push_back( ap );
+        
+        if (all())
+          continue;
+        
+        if (operands.video.size())
+          { throw Param("error", " one video at a time please...", ""); }
+        operands.video = ap;
+      }
     
-        char const* self;
-        char const* arg;
-        Analyser& analyser;
-        Operands& operands;
-        bool verbose;
-      } params(argv[0], analyser, operands);
+    if (not operands.video.size() and not operands.spool.size())
+      { throw Param("error", " no video given...", ""); }
+    return true;
+  }
+  virtual Analyser& ancfg() override { return analyser; }
+  virtual Operands& opcfg() override { return operands; }
+  virtual bool match(Param& param) override
+  {
+    char const* a = arg;
+    for (char const *b = param.name; *b; ++a, ++b)
+      { if (*a != *b) return false; }
+    if (*a++ != ':') return false;
+    param.set_args(a);
+    if (verbose)
+      { std::cerr << "[" << param.name << "] " << param.desc_help << "\n  " << a << " (" << param.args_help << ")\n"; }
+    return true;
+  }
+  
+  char const* self;
+  char const* arg;
+  Analyser& analyser;
+  Operands& operands;
+  bool verbose;
+};
 
-      assert( argv[argc] == 0 );
-      params.parse( argv );
+void
+paramerror( Params::Param const& param, std::ostream& sink )
+{
+  if (param.args)
+    {
+      sink << "---\nParameter read error:\n  " << param.args_start << "\n  ";
+      for (char const* cp = param.args_start; cp < param.args; ++cp)
+        sink << (isspace(*cp) ? *cp : ' '); /* XXX: unicode ? */
+      sink << "^\n";
     }
-  catch (Params::Param const& param)
+  param.usage( sink, 0 );
+}
+
+/* openframes: frame iterator suited to the video format */
+std::unique_ptr<FrameIterator>
+openframes( Operands const& operands )
+{
+  std::unique_ptr<FrameIterator> fi;
+  std::string const& video = operands.video;
+  // Buffers for the current frame, the one being decoded and the recorder's
+  uintptr_t spare = operands.recqueue + 2;
+  uintptr_t idx = video.rfind('.');
+  std::string ext( idx < video.size() ? video.substr(idx) : "" );
+  for (char& ch : ext) ch = tolower(ch);
+  
+  if      (operands.raw[0])
+    fi.reset( new MappedFrameIterator( video, operands.framestop, operands.raw[0], operands.raw[1], operands.raw[2], operands.fps ? operands.fps : 25 ) );
+  else if (ext == ".y4m")
+    fi.reset( new MappedFrameIterator( video, operands.framestop ) );
+  else if (SequenceFrameIterator::accept( video ))
+    fi.reset( new SequenceFrameIterator( video, operands.framestop, operands.fps ? operands.fps : 25, operands.prefetch, spare, operands.decoders ) );
+  else
+    fi.reset( new VideoFrameIterator( video, operands.framestop, spare ) );
+  
+  if (operands.fps)
+    fi->fps = operands.fps;
+  return fi;
+}
+
+std::string
+outprefix( std::string const& video )
+{
+  std::string prefix( video.substr( 0, video.find('%') ) ); // image sequence pattern
+  while (prefix.size() > 1 and prefix[prefix.size()-1] == '/')
+    prefix.resize( prefix.size()-1 );
+  uintptr_t idx = prefix.rfind('.'), sep = prefix.rfind('/');
+  if (idx < prefix.size() and (sep > prefix.size() or sep < idx))
+    prefix = prefix.substr(0,idx);
+  return prefix;
+}
+
+/* analyse: runs passes #0 (building frame index) and #1 and trajectory
+ * reconstruction (or, when reanalysing, only pass #1 on previously
+ * invalid frames), reporting progress to `log` (with terminal updates
+ * when `tty`)
+ */
+void
+analyse( Analyser& analyser, Operands const& operands, FrameIndex& index, std::ostream& log, bool tty )
+{
+  if (operands.fgreplay)
     {
-      if (param.args)
+      std::string prefix( outprefix( operands.video ) );
+      analyser.bg = cv::imread( prefix + "_bg.png", cv::IMREAD_UNCHANGED );
+      if (analyser.bg.empty()) throw "Error when reading background image";
+      analyser.select();
+      SparseReader store( prefix + "_fg.bin" );
+      if ((store.header.width != analyser.width()) or (store.header.height != analyser.height()))
+        throw "Sparse store does not match background";
+      if (not store.covers( analyser.roi() ))
+        throw "Crop exceeds the one of sparse store";
+      if (analyser.threshold < store.header.floor)
+        log << "Warning: threshold below stored floor (" << store.header.floor << "), results are approximate\n";
+      analyser.fps = store.header.fps;
+      
+      log << "Pass #1 (sparse store)\n";
+      Analyser::ROI const roi = analyser.roi();
+      for (uintptr_t frame = 0; frame < store.frames(); ++frame)
         {
-          std::cerr << "---\nParameter read error:\n  " << param.args_start << "\n  ";
-          for (char const* cp = param.args_start; cp < param.args; ++cp)
-            std::cerr << (isspace(*cp) ? *cp : ' '); /* XXX: unicode ? */
-          std::cerr << "^\n";
+          Moments moments;
+          store.moments( frame, roi, analyser.threshold, moments );
+          analyser.mices.push_back( moments.mice() );
         }
-      param.usage( std::cerr, 0 );
-      return 1;
+      log << "#frames: " << store.frames() << std::endl;
+      
+      analyser.trajectory();
+      return;
     }
   
-  std::string prefix( operands.video );
-  
-  {
-    uintptr_t idx = prefix.rfind('.');
-    if (idx < prefix.size())
-      prefix = prefix.substr(0,idx);
-  }
+  if (operands.reanalyse)
+    {
+      std::string prefix( outprefix( operands.video ) );
+      analyser.bg = cv::imread( prefix + "_bg.png", cv::IMREAD_UNCHANGED );
+      if (analyser.bg.empty()) throw "Error when reading background image";
+      analyser.select();
+      std::ifstream source( (prefix + ".csv").c_str() );
+      if (not source) throw "Error when reading previous results";
+      analyser.loadresults( source );
+      
+      log << "Pass #1 (invalid frames)\n";
+      std::unique_ptr<FrameIterator> itr( openframes( operands ) );
+      analyser.fps = itr->fps;
+      // Reading forward up to a second rather than seeking
+      uintptr_t analysed = analyser.reanalyse( *itr, std::max<uintptr_t>( itr->fps, 1 ) );
+      log << "#analysed: " << analysed << '/' << analyser.mices.size() << " frames" << std::endl;
+      
+      analyser.trajectory();
+      return;
+    }
   
-  std::cerr << "Pass #0\n";
+  log << "Pass #0\n";
   {
     Analyser::Pass0 pass0;
-    for (VideoFrameIterator itr( operands.video, operands.framestop ); itr.next(); )
+    std::unique_ptr<FrameIterator> itr( openframes( operands ) );
+    analyser.fps = itr->fps;
+    while (itr->next())
       {
-        itr.progress(std::cerr);
-        analyser.step( itr, pass0 );
+        itr->progress(log, tty);
+        index.add( itr->msec() );
+        analyser.step( *itr, pass0 );
       }
-    std::cerr << "\n#frames: " << pass0.records << '\n';
+    log << "\n#frames: " << pass0.records << '\n';
     analyser.finish( pass0 );
   }
   
-  std::cerr << "Pass #1\n";
-  for (VideoFrameIterator itr( operands.video, operands.framestop ); itr.next(); )
+  log << "Pass #1\n";
+  if (analyser.stride > 1)
     {
-      itr.progress(std::cerr);
-      analyser.pass1( itr.frame );
+      if (operands.fgfloor)
+        log << "Warning: no sparse foreground store in stride mode\n";
+      std::unique_ptr<FrameIterator> itr( openframes( operands ) );
+      uintptr_t analysed = analyser.stridepass1( *itr, log, tty );
+      log << "#analysed: " << analysed << '/' << analyser.mices.size() << " frames";
     }
-  std::cerr << std::endl;
+  else
+    {
+      std::unique_ptr<FrameIterator> itr( openframes( operands ) );
+      std::unique_ptr<SparseWriter> store;
+      if (operands.fgfloor)
+        {
+          store.reset( new SparseWriter( outprefix( operands.video ) + "_fg.bin", analyser.width(), analyser.height(), analyser.roi(), operands.fgfloor, itr->fps ) );
+          analyser.fgstore = store.get();
+        }
+      while (itr->next())
+        {
+          itr->progress(log, tty);
+          analyser.pass1( itr->frame );
+        }
+      analyser.fgstore = 0;
+      if (store)
+        store->close();
+      if (itr->pool)
+        log << "\n#frame allocations: " << itr->pool->allocations;
+    }
+  if (analyser.tileskips.size())
+    {
+      std::vector<float> const& skips = analyser.tileskips;
+      double sum = 0;
+      for (float skip : skips) sum += skip;
+      log << "\n#tiles skipped per frame: " << (sum / skips.size())
+          << " (min " << *std::min_element( skips.begin(), skips.end() )
+          << ", max " << *std::max_element( skips.begin(), skips.end() ) << ")";
+    }
+  log << std::endl;
   
   analyser.trajectory();
+}
+
+/* results: writes requested outputs of a completed analysis */
+bool
+results( Analyser& analyser, Operands const& operands, FrameIndex const& index, std::ostream& log )
+{
+  std::string prefix( outprefix( operands.video ) );
+  bool success = true;
+  
+  if (operands.csv)
+    {
+      std::ofstream sink( (prefix + ".csv").c_str() );
+      analyser.dumpresults( sink );
+      success = success and sink;
+      // Background and frame index, for later reanalysis and review
+      success = success and cv::imwrite( prefix + "_bg.png", analyser.bg );
+      if (index.msecs.size())
+        success = success and index.save( prefix + "_index.csv" );
+    }
+  
+  if (operands.metrics)
+    {
+      Metrics metrics;
+      if (operands.immobility[0] >= 0) metrics.immobilespeed = operands.immobility[0];
+      if (operands.immobility[1] >= 0) metrics.immobileduration = operands.immobility[1];
+      metrics.zones = operands.zones;
+      metrics.compute( analyser.mices, analyser.fps );
+      std::ofstream sink( (prefix + "_metrics.csv").c_str() );
+      metrics.dump( sink );
+      success = success and sink;
+    }
+  
+  return success;
+}
+
+/* runjob: non-interactive analysis of a spooled job, decoding image
+ * sequences with (at most) `decoders` threads */
+bool
+runjob( char const* self, uintptr_t decoders, Spool::Args const& args, std::ostream& log )
+{
+  Analyser analyser;
+  Operands operands;
+  
+  std::vector<char const*> argv( 1, self );
+  for (std::string const& arg : args)
+    argv.push_back( arg.c_str() );
+  argv.push_back( 0 );
+  
+  try
+    {
+      GetParams params(self, analyser, operands);
+      params.verbose = false;
+      if (not params.parse( &argv[0] ) or operands.spool.size() or not operands.video.size())
+        { throw Params::Param("error", " expecting a video and analysis parameters...", ""); }
+    }
+  catch (Params::Param const& param)
+    {
+      paramerror( param, log );
+      return false;
+    }
+  
+  operands.decoders = decoders;
+  
+  FrameIndex index;
+  analyse( analyser, operands, index, log, false );
+  
+  return results( analyser, operands, index, log );
+}
+
+int
+main( int argc, char** argv )
+{
+  Analyser analyser;
+  Operands operands;
 
-  if (operands.interactive)
+  try
+    {
+      GetParams params(argv[0], analyser, operands);
+
+      assert( argv[argc] == 0 );
+      if (not params.parse( argv ))
+        {
+          help(argv[0], std::cout);
+          return 0;
+        }
+    }
+  catch (Params::Param const& param)
+    {
+      paramerror( param, std::cerr );
+      return 1;
+    }
+  
+  if (operands.spool.size())
+    {
+      char const* self = argv[0];
+      // Concurrent jobs share CPUs for decoding
+      uintptr_t decoders = std::max<uintptr_t>( std::thread::hardware_concurrency() / operands.jobs, 1 );
+      try
+        {
+          Spool spool( operands.spool, operands.jobs );
+          spool.serve( [self,decoders] (Spool::Args const& args, std::ostream& log) { return runjob( self, decoders, args, log ); } );
+        }
+      catch (char const* what)
+        {
+          std::cerr << what << std::endl;
+          return 1;
+        }
+      return 0;
+    }
+  
+  std::string prefix( outprefix( operands.video ) );
+  
+  FrameIndex index;
+  analyse( analyser, operands, index, std::cerr, true );
+  if (index.msecs.empty())
+    index.load( prefix + "_index.csv", analyser.mices.size() );
+
+  if (operands.interactive and not operands.fgreplay)
     {
       cv::namedWindow( "w", cv::WINDOW_AUTOSIZE );
   
       cv::setMouseCallback( "w", (cv::MouseCallback)mouse_callback, &analyser );
       bool keylogger = operands.keylogspeed;
       int kwait = 0;
-      cv::VideoWriter writer;
+      Recorder recorder( operands.recqueue, operands.recdrop );
       typedef std::map<double,char> KeyLog;
       KeyLog keylog;
     
-      for (VideoFrameIterator itr( operands.video, operands.framestop ); itr.next();)
+      std::string typed; // number typed before a seek command
+      cv::Mat scratch; // drawing copy of frames not owned by a pool buffer
+    
+      for (std::unique_ptr<FrameIterator> itr( openframes( operands ) ); itr->next();)
 	{
-	  analyser.redraw( itr );
-	  imshow( "w", itr.frame );
+	  if (not itr->buffer)
+	    {
+	      itr->frame.copyTo( scratch );
+	      itr->frame = scratch;
+	    }
+	  analyser.redraw( *itr );
+	  imshow( "w", itr->frame );
 	  int k = cv::waitKey(kwait);
+	  while (not kwait and ((k >= '0' and k <= '9') or k == '.'))
+	    {
+	      typed += char(k);
+	      std::cerr << "==> " << typed << " (g: go to frame, t: go to second)\n";
+	      k = cv::waitKey(0);
+	    }
 
-	  if (writer.isOpened())
-	    writer << itr.frame;
+	  if (recorder.isOpened())
+	    recorder.push( itr->frame, itr->buffer );
       
 	  if (k == -1)
 	    continue;
@@ -387,17 +855,40 @@ main( int argc, char** argv )
 	    {
 	      // Play mode, log key if necessary
 	      if (keylogger)
-		keylog.insert(KeyLog::value_type(itr.sec(), k));
+		keylog.insert(KeyLog::value_type(itr->sec(), k));
 	      continue;
 	    }
 
+	  // Pause mode: any other key steps forward, seek keys go anywhere
+	  uintptr_t const current = itr->idx - 1, count = analyser.mices.size();
+	  uintptr_t target = count;
+	  std::string const number( typed );
+	  typed.clear(); // only meant for the key right after it
 	  switch (k)
 	    {
+	    case 'g':
+	      target = strtoul( number.c_str(), 0, 10 );
+	      break;
+	    case 't':
+	      target = index.frame( strtod( number.c_str(), 0 ), itr->fps );
+	      break;
+	    case 'b':
+	      target = current ? current - 1 : 0;
+	      break;
+	    case 'n':
+	      for (target = current + 1; (target < count) and not analyser.mices[target].rejected(); ++target) {}
+	      if (target >= count) { std::cerr << "No next invalid frame\n"; target = current; }
+	      break;
+	    case 'p':
+	      for (target = current; (target-- > 0) and not analyser.mices[target].rejected();) {}
+	      if (target >= count) { std::cerr << "No previous invalid frame\n"; target = current; }
+	      break;
 	    case 'r':
-	      writer.open( (prefix + "_rec.avi").c_str(), CV_FOURCC('M','J','P','G'), 25, cv::Size( analyser.width(), analyser.height() ) );
+	      if (not recorder.open( prefix + "_rec.avi", itr->fps, cv::Size( analyser.width(), analyser.height() ), itr->frame.channels() != 1 ))
+	        std::cerr << "Error when opening recording file\n";
 	      /* move on to set kwait */
 	    case '\n': case '\r':
-	      kwait = keylogger ? std::max<int>(1000./(itr.fps*operands.keylogspeed), 1) : 1;
+	      kwait = keylogger ? std::max<int>(1000./(itr->fps*operands.keylogspeed), 1) : 1;
 	      break;
 	    case '\b': 
 	      analyser.restart();
@@ -406,10 +897,22 @@ main( int argc, char** argv )
 	      std::cerr << "KeyCode: " << k << "\n";
 	      break;
 	    }
+	  
+	  if (target < count)
+	    {
+	      std::cerr << "==> frame " << target << '\n';
+	      if (not itr->seek( target ))
+	        std::cerr << "Cannot seek to frame " << target << '\n';
+	    }
+	  else if (k == 'g' or k == 't')
+	    std::cerr << "No such frame\n";
 	}
   
-      if (writer.isOpened())
-	writer.release();
+      if (recorder.isOpened())
+	{
+	  recorder.release();
+	  std::cerr << "Recording: " << recorder.dropped << " dropped frames\n";
+	}
   
       cv::destroyWindow( "w" );
 
@@ -421,8 +924,5 @@ main( int argc, char** argv )
 	}
     }
   
-  std::ofstream sink( (prefix + ".csv").c_str() );
-  analyser.dumpresults( sink );
-
-  return 0;
+  return results( analyser, operands, index, std::cerr ) ? 0 : 1;
 }